@@ -0,0 +1,1858 @@
+#include "netev.h"
+#include "netbuf.h"
+#include "netgroup.h"
+#include <arpa/inet.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <signal.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <time.h>
+
+#pragma pack(1)
+struct msg_header {
+    uint16_t size;
+};
+#pragma pack()
+
+static struct netev* ne = NULL;
+static uint64_t nmsg_read = 0;
+static int batch = 0;
+
+static uint64_t
+get_time() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000 + ts.tv_nsec /1000000;
+}
+
+static uint64_t
+get_usec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static uint64_t
+get_nsec() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// a plain blocking sender, so the netev side is the only thing measured
+static void
+_sender(uint16_t port, int nconn, int nmsg, int msgsize) {
+    int fds[nconn];
+    int i, j;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    for (i=0; i<nconn; ++i) {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            exit(1);
+        }
+    }
+    int size = sizeof(struct msg_header) + msgsize;
+    char data[size];
+    memset(data, 'x', size);
+    ((struct msg_header*)data)->size = msgsize;
+    for (j=0; j<nmsg; ++j) {
+        for (i=0; i<nconn; ++i) {
+            int wsize = 0;
+            while (wsize < size) {
+                int nbyte = write(fds[i], data + wsize, size - wsize);
+                if (nbyte <= 0) {
+                    perror("write");
+                    exit(1);
+                }
+                wsize += nbyte;
+            }
+        }
+    }
+    sleep(1);
+    for (i=0; i<nconn; ++i) {
+        close(fds[i]);
+    }
+    exit(0);
+}
+
+static void
+_edge_readcb(int fd, int id, void* data) {
+    int n = 0;
+    for (;;) {
+        if (batch > 0 && n >= batch)
+            return; // leave the rest to the next dispatch
+        struct msg_header* h = netev_read(ne, id, sizeof(struct msg_header));
+        if (h == NULL)
+            return;
+        void* msg = netev_read(ne, id, h->size);
+        if (msg == NULL)
+            return;
+        netev_dropread(ne, id);
+        nmsg_read++;
+        n++;
+    }
+}
+
+static void
+_edge_listencb(int fd, int id) {
+    netev_add_event(ne, id, NETEV_READ, _edge_readcb, NULL, NULL);
+}
+
+static int
+_bench_edge(int flags, uint16_t port, int nconn, int nmsg, int msgsize) {
+    ne = netev_create_flags(nconn+1, 64*1024, flags);
+    if (netev_listen(ne, inet_addr("127.0.0.1"), port, _edge_listencb) != 0) {
+        printf("listen on %u failed\n", port);
+        return -1;
+    }
+    nmsg_read = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _sender(port, nconn, nmsg, msgsize);
+    }
+    uint64_t total = (uint64_t)nconn * nmsg;
+    uint64_t start = get_time();
+    while (nmsg_read < total) {
+        netev_poll(ne, 100);
+    }
+    uint64_t elapse = get_time() - start;
+    waitpid(pid, NULL, 0);
+
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    printf("%-5s msgs %llu, polls %llu, wakeups %llu, events %llu, requeued %llu, "
+           "wakeups/msg %.4f, events/msg %.4f, elapse %llums\n",
+            (flags & NETEV_EDGE) ? "edge" : "level",
+            (unsigned long long)total,
+            (unsigned long long)st.npoll,
+            (unsigned long long)st.nwakeup,
+            (unsigned long long)st.nevent,
+            (unsigned long long)st.nrequeue,
+            st.nwakeup / (double)total,
+            (st.nevent + st.nrequeue) / (double)total,
+            (unsigned long long)elapse);
+    netev_free(ne);
+    ne = NULL;
+    return 0;
+}
+
+static int
+_edge(int argc, char* argv[]) {
+    int nconn   = argc > 0 ? strtol(argv[0], NULL, 10) : 100;
+    int nmsg    = argc > 1 ? strtol(argv[1], NULL, 10) : 1000;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 64;
+    batch       = argc > 3 ? strtol(argv[3], NULL, 10) : 4;
+    printf("edge: conn %d, msg %d, msgsize %d, batch %d\n", nconn, nmsg, msgsize, batch);
+    if (_bench_edge(0, 23456, nconn, nmsg, msgsize) != 0)
+        return -1;
+    if (_bench_edge(NETEV_EDGE, 23457, nconn, nmsg, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// the client's profile: many connections of u16 framed messages read with
+// netev_read and netev_dropread, what the read blocks moved and held
+// ne reads what the sender sends with _edge_readcb, returns the ms it took
+static uint64_t
+_receive(int flags, int block_size, uint16_t port, int nconn, int nmsg, int msgsize) {
+    ne = netev_create_flags(nconn+1, block_size, flags);
+    if (ne == NULL) {
+        printf("create failed\n");
+        return 0;
+    }
+    if (netev_listen(ne, inet_addr("127.0.0.1"), port, _edge_listencb) != 0) {
+        printf("listen on %u failed\n", port);
+        return 0;
+    }
+    nmsg_read = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _sender(port, nconn, nmsg, msgsize);
+    }
+    uint64_t total = (uint64_t)nconn * nmsg;
+    uint64_t start = get_time();
+    while (nmsg_read < total) {
+        netev_poll(ne, 100);
+    }
+    uint64_t elapse = get_time() - start;
+    waitpid(pid, NULL, 0);
+    return elapse > 0 ? elapse : 1;
+}
+
+static int
+_bench_block(int flags, uint16_t port, int nconn, int nmsg, int msgsize) {
+    uint64_t total = (uint64_t)nconn * nmsg;
+    uint64_t elapse = _receive(flags, 64*1024, port, nconn, nmsg, msgsize);
+    if (elapse == 0)
+        return -1;
+
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    printf("%-6s msgs %llu, moved %llu bytes, %.1f MB/s moved, %.0f msgs/s, elapse %llums\n",
+            (flags & NETEV_MIRROR) ? "mirror" : (flags & NETEV_POOL) ? "pool" : "plain",
+            (unsigned long long)total,
+            (unsigned long long)st.ncompact,
+            st.ncompact / 1048576.0 * 1000.0 / elapse,
+            total * 1000.0 / elapse,
+            (unsigned long long)elapse);
+    printf("       buffers held %lld KB, high-water %lld KB, pool hits %llu, misses %llu\n",
+            (long long)st.pool_inuse / 1024,
+            (long long)st.pool_highwater / 1024,
+            (unsigned long long)st.npool_hit,
+            (unsigned long long)st.npool_miss);
+    netev_free(ne);
+    ne = NULL;
+    return 0;
+}
+
+static int
+_mirror(int argc, char* argv[]) {
+    int nconn   = argc > 0 ? strtol(argv[0], NULL, 10) : 100;
+    int nmsg    = argc > 1 ? strtol(argv[1], NULL, 10) : 2000;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 1024;
+    batch = 0;
+    printf("mirror: conn %d, msg %d, msgsize %d\n", nconn, nmsg, msgsize);
+    if (_bench_block(0, 23459, nconn, nmsg, msgsize) != 0)
+        return -1;
+    if (_bench_block(NETEV_MIRROR, 23460, nconn, nmsg, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+static int
+_pool(int argc, char* argv[]) {
+    int nconn   = argc > 0 ? strtol(argv[0], NULL, 10) : 1000;
+    int nmsg    = argc > 1 ? strtol(argv[1], NULL, 10) : 200;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 1024;
+    batch = 0;
+    printf("pool: conn %d, msg %d, msgsize %d\n", nconn, nmsg, msgsize);
+    if (_bench_block(0, 23461, nconn, nmsg, msgsize) != 0)
+        return -1;
+    if (_bench_block(NETEV_POOL, 23462, nconn, nmsg, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// dTLB load misses of this process in user space, -1 without perf events
+static int
+_dtlb_open() {
+    struct perf_event_attr attr;
+    memset(&attr, 0, sizeof(attr));
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.size = sizeof(attr);
+    attr.config = PERF_COUNT_HW_CACHE_DTLB |
+        (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+        (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    return syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0);
+}
+
+static int
+_bench_arena(int flags, uint16_t port, int nconn, int nmsg, int msgsize, int block_size) {
+    int fd = _dtlb_open();
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+    uint64_t total = (uint64_t)nconn * nmsg;
+    uint64_t elapse = _receive(flags, block_size, port, nconn, nmsg, msgsize);
+    if (elapse == 0)
+        return -1;
+    uint64_t misses = 0;
+    if (fd >= 0) {
+        ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+        if (read(fd, &misses, sizeof(misses)) != sizeof(misses))
+            misses = 0;
+        close(fd);
+    }
+    char tlb[32] = "n/a";
+    if (fd >= 0)
+        snprintf(tlb, sizeof(tlb), "%.3f", misses / (double)total);
+    printf("%-8s msgs %llu, %.0f msgs/s, dTLB misses/msg %s, elapse %llums\n",
+            (flags & NETEV_HUGEPAGE) ? "hugepage" : "malloc",
+            (unsigned long long)total,
+            total * 1000.0 / elapse,
+            tlb,
+            (unsigned long long)elapse);
+    netev_free(ne);
+    ne = NULL;
+    return 0;
+}
+
+// 50k blocks of 64 KB: past id 32767 the offset of a block is beyond
+// 2 GB, each of those must land where its id says. touches one block
+// per id from there on
+static int
+_arena_top(int flags) {
+    int max = 50000;
+    int block_size = 64*1024;
+    struct netbuf* nb = netbuf_create_flags(max, block_size, flags);
+    if (nb == NULL) {
+        printf("arena of %d x %d not available, skipped\n", max, block_size);
+        return 0;
+    }
+    struct netbuf_block* first = netbuf_alloc_block(nb, 0);
+    int id;
+    for (id=32768; id<max; id+=4096) {
+        struct netbuf_block* b = netbuf_alloc_block(nb, id);
+        if ((size_t)((char*)b - (char*)first) != (size_t)id * block_size) {
+            printf("block %d at the wrong offset\n", id);
+            netbuf_free(nb);
+            return -1;
+        }
+        memset(netbuf_wptr(b), 'a', netbuf_space(b));
+    }
+    netbuf_free(nb);
+    printf("arena top: blocks past 2 GB of a %d x %d arena ok\n", max, block_size);
+    return 0;
+}
+
+// many connections each touching its own block, so the arena's pages
+// are spread wide. nconn is capped by the fd limit
+static int
+_arena(int argc, char* argv[]) {
+    int nconn      = argc > 0 ? strtol(argv[0], NULL, 10) : 50000;
+    int nmsg       = argc > 1 ? strtol(argv[1], NULL, 10) : 20;
+    int msgsize    = argc > 2 ? strtol(argv[2], NULL, 10) : 64;
+    int block_size = argc > 3 ? strtol(argv[3], NULL, 10) : 16*1024;
+    int node       = argc > 4 ? strtol(argv[4], NULL, 10) : -1;
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (nconn > (int)rl.rlim_cur - 64)
+            nconn = rl.rlim_cur - 64;
+    }
+    batch = 0;
+    printf("arena: conn %d, msg %d, msgsize %d, block %d, node %d\n", 
+            nconn, nmsg, msgsize, block_size, node);
+    int flags = NETEV_HUGEPAGE|NETEV_PREFAULT;
+    if (node >= 0)
+        flags |= NETEV_NODE(node);
+    if (_arena_top(NETBUF_HUGEPAGE) != 0)
+        return -1;
+    if (_bench_arena(0, 23463, nconn, nmsg, msgsize, block_size) != 0)
+        return -1;
+    if (_bench_arena(flags, 23464, nconn, nmsg, msgsize, block_size) != 0)
+        return -1;
+    return 0;
+}
+
+static int nsink_conn = 0;
+static int nsink_closed = 0;
+
+static void
+_sink_msgcb(int id, void* msg, int size) {
+}
+
+static void
+_sink_closecb(int fd, int id, void* data, int error) {
+    if (++nsink_closed == nsink_conn)
+        exit(0);
+}
+
+static void
+_sink_listencb(int fd, int id) {
+    netev_add_frame(ne, id, NETEV_FRAME_U32LE, _sink_msgcb, NULL, NULL);
+}
+
+// a netev that takes nconn connections and reads frames until they close
+static void
+_frame_sink(uint16_t port, int nconn) {
+    ne = netev_create(nconn+1, 256*1024);
+    if (netev_listen(ne, inet_addr("127.0.0.1"), port, _sink_listencb) != 0) {
+        printf("listen on %u failed\n", port);
+        exit(1);
+    }
+    nsink_conn = nconn;
+    netev_set_closecb(ne, _sink_closecb);
+    for (;;) {
+        netev_poll(ne, -1);
+    }
+}
+
+static int* bc_ids = NULL;
+static int bc_nid = 0;
+
+static void
+_bc_connectcb(int fd, int id, void* data, int error) {
+    if (error == 0)
+        bc_ids[bc_nid++] = id;
+}
+
+static void
+_bc_msgcb(int id, void* msg, int size) {
+}
+
+// keep the queues short, and wait them out at the end
+static void
+_bc_drain(int limit) {
+    int i;
+    for (i=0; i<bc_nid; ++i) {
+        while (netev_sendsize(ne, bc_ids[i]) > limit) {
+            netev_poll(ne, 10);
+        }
+    }
+}
+
+static int
+_bench_broadcast(int shared, uint16_t port, int nconn, int nmsg, int msgsize) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _frame_sink(port, nconn);
+    }
+    usleep(100000);
+    ne = netev_create(nconn+1, 4096);
+    bc_ids = malloc(nconn * sizeof(int));
+    bc_nid = 0;
+    int i, j;
+    for (i=0; i<nconn; ++i) {
+        if (netev_connect(ne, inet_addr("127.0.0.1"), port, 1, _bc_connectcb, NULL) != 0) {
+            printf("connect failed\n");
+            return -1;
+        }
+    }
+    for (i=0; i<bc_nid; ++i) {
+        netev_add_frame(ne, bc_ids[i], NETEV_FRAME_U32LE, _bc_msgcb, NULL, NULL);
+    }
+    char* msg = malloc(msgsize);
+    memset(msg, 'b', msgsize);
+    uint64_t copied = 0;
+    uint64_t start = get_time();
+    for (j=0; j<nmsg; ++j) {
+        if (shared) {
+            struct netev_buf* buf = netev_buf_frame(NETEV_FRAME_U32LE, msg, msgsize);
+            netev_broadcast(ne, bc_ids, bc_nid, buf);
+            netev_buf_release(buf);
+            copied += msgsize;
+        } else {
+            for (i=0; i<bc_nid; ++i) {
+                netev_send_frame(ne, bc_ids[i], msg, msgsize);
+            }
+            copied += (uint64_t)bc_nid * msgsize;
+        }
+        netev_poll(ne, 0);
+        _bc_drain(256*1024);
+    }
+    _bc_drain(0);
+    uint64_t elapse = get_time() - start;
+    if (elapse == 0)
+        elapse = 1;
+    netev_free(ne); // closes, io_uring ones are submitted here
+    ne = NULL;
+    waitpid(pid, NULL, 0);
+    uint64_t total = (uint64_t)bc_nid * nmsg * msgsize;
+    printf("%-6s conns %d, fan-out %.1f MB/s, copied into queues %llu MB, elapse %llums\n",
+            shared ? "shared" : "copy", bc_nid,
+            total / 1048576.0 * 1000.0 / elapse,
+            (unsigned long long)(copied / 1048576),
+            (unsigned long long)elapse);
+    free(msg);
+    free(bc_ids);
+    bc_ids = NULL;
+    return 0;
+}
+
+static int
+_broadcast(int argc, char* argv[]) {
+    int nconn   = argc > 0 ? strtol(argv[0], NULL, 10) : 1000;
+    int nmsg    = argc > 1 ? strtol(argv[1], NULL, 10) : 200;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 4096;
+    printf("broadcast: conn %d, msg %d, msgsize %d\n", nconn, nmsg, msgsize);
+    if (_bench_broadcast(0, 23465, nconn, nmsg, msgsize) != 0)
+        return -1;
+    if (_bench_broadcast(1, 23466, nconn, nmsg, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// same host transports: TCP loopback, AF_UNIX stream and seqpacket.
+// the peer echoes 'p' frames and answers every uw_total other frames
+// with one, for round trips and one way throughput
+#define UW_TCP       0
+#define UW_STREAM    1
+#define UW_SEQPACKET 2
+#define UW_PATH      "/tmp/netev_bench.sock"
+#define UW_ABSTRACT  "@netev_bench_seqpacket"
+
+static int uw_total = 0;
+static int uw_count = 0;
+static int uw_spin = 0;
+static int uw_id = -1;
+static int uw_reply = 0;
+
+static void
+_uw_echocb(int id, void* msg, int size) {
+    if (*(char*)msg == 'p') {
+        netev_send_frame(ne, id, msg, size);
+    } else if (++uw_count == uw_total) {
+        uw_count = 0;
+        netev_send_frame(ne, id, "a", 1);
+    }
+}
+
+static void
+_uw_listencb(int fd, int id) {
+    netev_add_frame(ne, id, NETEV_FRAME_U32LE, _uw_echocb, NULL, NULL);
+}
+
+static void
+_uw_closecb(int fd, int id, void* data, int error) {
+    exit(0);
+}
+
+static void
+_uw_peer(int kind, uint16_t port) {
+    ne = netev_create(2, 256*1024);
+    netev_set_busy_poll(ne, uw_spin, uw_spin);
+    int r;
+    if (kind == UW_TCP)
+        r = netev_add_listen(ne, inet_addr("127.0.0.1"), port, 0, _uw_listencb, NULL);
+    else
+        r = netev_listen_unix(ne, kind == UW_STREAM ? UW_PATH : UW_ABSTRACT,
+                kind == UW_STREAM ? SOCK_STREAM : SOCK_SEQPACKET, 0, _uw_listencb, NULL);
+    if (r < 0) {
+        printf("listen failed\n");
+        exit(1);
+    }
+    netev_set_closecb(ne, _uw_closecb);
+    for (;;) {
+        netev_poll(ne, -1);
+    }
+}
+
+static void
+_uw_connectcb(int fd, int id, void* data, int error) {
+    if (error == 0)
+        uw_id = id;
+}
+
+static void
+_uw_replycb(int id, void* msg, int size) {
+    uw_reply++;
+}
+
+static int
+_bench_unix(int kind, uint16_t port, int nping, int nmsg, int msgsize) {
+    static const char* names[] = { "tcp", "stream", "seqpacket" };
+    uw_total = nmsg;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _uw_peer(kind, port);
+    }
+    usleep(100000);
+    ne = netev_create(2, 256*1024);
+    uw_id = -1;
+    uw_reply = 0;
+    if (kind == UW_TCP)
+        netev_connect(ne, inet_addr("127.0.0.1"), port, 1, _uw_connectcb, NULL);
+    else
+        netev_connect_unix(ne, kind == UW_STREAM ? UW_PATH : UW_ABSTRACT, 
+                kind == UW_STREAM ? SOCK_STREAM : SOCK_SEQPACKET, 1, _uw_connectcb, NULL);
+    if (uw_id < 0) {
+        printf("connect failed\n");
+        return -1;
+    }
+    netev_add_frame(ne, uw_id, NETEV_FRAME_U32LE, _uw_replycb, NULL, NULL);
+
+    // one 64 byte frame in flight
+    char ping[64];
+    memset(ping, 'p', sizeof(ping));
+    int i;
+    uint64_t start = get_usec();
+    for (i=0; i<nping; ++i) {
+        netev_send_frame(ne, uw_id, ping, sizeof(ping));
+        while (uw_reply == i) {
+            netev_poll(ne, 100);
+        }
+    }
+    uint64_t rtt = get_usec() - start;
+
+    // as fast as the peer reads, the queue kept short
+    char* msg = malloc(msgsize);
+    memset(msg, 't', msgsize);
+    int reply = uw_reply;
+    start = get_usec();
+    for (i=0; i<nmsg; ++i) {
+        netev_send_frame(ne, uw_id, msg, msgsize);
+        while (netev_sendsize(ne, uw_id) > 256*1024) {
+            netev_poll(ne, 10);
+        }
+    }
+    while (uw_reply == reply) {
+        netev_poll(ne, 100);
+    }
+    uint64_t elapse = get_usec() - start;
+    if (elapse == 0)
+        elapse = 1;
+    netev_free(ne);
+    ne = NULL;
+    waitpid(pid, NULL, 0);
+    printf("%-9s rtt %.1f us, %.0f round trips/s, throughput %.1f MB/s, %.0f msgs/s\n",
+            names[kind], rtt / (double)nping, nping * 1000000.0 / rtt,
+            (double)nmsg * msgsize / elapse * 1000000.0 / 1048576.0,
+            nmsg * 1000000.0 / elapse);
+    free(msg);
+    return 0;
+}
+
+static int
+_unix(int argc, char* argv[]) {
+    int nping   = argc > 0 ? strtol(argv[0], NULL, 10) : 20000;
+    int nmsg    = argc > 1 ? strtol(argv[1], NULL, 10) : 200000;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 1024;
+    printf("unix: round trips %d, msg %d, msgsize %d\n", nping, nmsg, msgsize);
+    int kind;
+    for (kind=UW_TCP; kind<=UW_SEQPACKET; ++kind) {
+        if (_bench_unix(kind, 23467, nping, nmsg, msgsize) != 0)
+            return -1;
+    }
+    unlink(UW_PATH);
+    return 0;
+}
+
+static int
+_cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a;
+    uint64_t y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+// request to response at low load: one ping every gap us over TCP 
+// loopback, both ends blocking in their waits, or spinning first
+static int
+_bench_busypoll(int spin, uint16_t port, int nping, int gap) {
+    uw_spin = spin;
+    uw_total = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _uw_peer(UW_TCP, port);
+    }
+    usleep(100000);
+    ne = netev_create(2, 64*1024);
+    netev_set_busy_poll(ne, spin, spin);
+    uw_id = -1;
+    uw_reply = 0;
+    netev_connect(ne, inet_addr("127.0.0.1"), port, 1, _uw_connectcb, NULL);
+    if (uw_id < 0) {
+        printf("connect failed\n");
+        return -1;
+    }
+    netev_add_frame(ne, uw_id, NETEV_FRAME_U32LE, _uw_replycb, NULL, NULL);
+
+    uint64_t* rtt = malloc(nping * sizeof(uint64_t));
+    char ping[64];
+    memset(ping, 'p', sizeof(ping));
+    int i;
+    for (i=0; i<nping; ++i) {
+        usleep(gap);
+        uint64_t start = get_usec();
+        netev_send_frame(ne, uw_id, ping, sizeof(ping));
+        while (uw_reply == i) {
+            netev_poll(ne, 100);
+        }
+        rtt[i] = get_usec() - start;
+    }
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    netev_free(ne);
+    ne = NULL;
+    waitpid(pid, NULL, 0);
+    qsort(rtt, nping, sizeof(uint64_t), _cmp_u64);
+    printf("%-5s p50 %llu us, p99 %llu us, max %llu us, here spun %llu ms, blocked %llu ms\n",
+            spin ? "spin" : "block",
+            (unsigned long long)rtt[nping / 2],
+            (unsigned long long)rtt[nping * 99 / 100],
+            (unsigned long long)rtt[nping - 1],
+            (unsigned long long)(st.spin_ns / 1000000),
+            (unsigned long long)(st.block_ns / 1000000));
+    free(rtt);
+    return 0;
+}
+
+static int
+_busypoll(int argc, char* argv[]) {
+    int nping = argc > 0 ? strtol(argv[0], NULL, 10) : 5000;
+    int gap   = argc > 1 ? strtol(argv[1], NULL, 10) : 200;
+    int spin  = argc > 2 ? strtol(argv[2], NULL, 10) : 1000;
+    printf("busypoll: round trips %d, gap %d us, spin %d us\n", nping, gap, spin);
+    if (sysconf(_SC_NPROCESSORS_ONLN) < 2)
+        printf("one cpu online: the two ends spin against each other, expect spin to lose\n");
+    if (_bench_busypoll(0, 23468, nping, gap) != 0)
+        return -1;
+    if (_bench_busypoll(spin, 23469, nping, gap) != 0)
+        return -1;
+    return 0;
+}
+
+// pipelined small requests: each round every connection writes a burst
+// of frames in one go, the netev side echoes each frame as it parses it
+static void
+_ck_echocb(int id, void* msg, int size) {
+    netev_send_frame(ne, id, msg, size);
+}
+
+// TCP_NODELAY on both ends: without it the uncorked writes wait on 
+// Nagle and delayed acks, not on their syscalls
+static void
+_ck_listencb(int fd, int id) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    netev_add_frame(ne, id, NETEV_FRAME_U32LE, _ck_echocb, NULL, NULL);
+}
+
+static void
+_ck_client(uint16_t port, int nconn, int nburst, int nround, int msgsize) {
+    int fds[nconn];
+    int i, j, k;
+    int one = 1;
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    for (i=0; i<nconn; ++i) {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            exit(1);
+        }
+        setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    int size = (4 + msgsize) * nburst;
+    char* data = malloc(size);
+    char* p = data;
+    memset(data, 'c', size);
+    for (k=0; k<nburst; ++k) {
+        uint32_t len = msgsize;
+        memcpy(p, &len, 4); // little endian host
+        p += 4 + msgsize;
+    }
+    char* echo = malloc(size);
+    for (j=0; j<nround; ++j) {
+        for (i=0; i<nconn; ++i) {
+            if (write(fds[i], data, size) != size) {
+                perror("write");
+                exit(1);
+            }
+        }
+        for (i=0; i<nconn; ++i) {
+            int rsize = 0;
+            while (rsize < size) {
+                int nbyte = read(fds[i], echo + rsize, size - rsize);
+                if (nbyte <= 0) {
+                    perror("read");
+                    exit(1);
+                }
+                rsize += nbyte;
+            }
+        }
+    }
+    exit(0);
+}
+
+// Tcp OutSegs from /proc/net/snmp, 0 if not there
+static uint64_t
+_tcp_outsegs() {
+    FILE* f = fopen("/proc/net/snmp", "r");
+    if (f == NULL)
+        return 0;
+    char names[1024], values[1024];
+    uint64_t segs = 0;
+    while (fgets(names, sizeof(names), f) && fgets(values, sizeof(values), f)) {
+        if (strncmp(names, "Tcp:", 4) != 0)
+            continue;
+        // the same column in both lines
+        char* sn;
+        char* sv;
+        char* n = strtok_r(names, " \n", &sn);
+        char* v = strtok_r(values, " \n", &sv);
+        while (n && v) {
+            if (strcmp(n, "OutSegs") == 0) {
+                segs = strtoull(v, NULL, 10);
+                break;
+            }
+            n = strtok_r(NULL, " \n", &sn);
+            v = strtok_r(NULL, " \n", &sv);
+        }
+        break;
+    }
+    fclose(f);
+    return segs;
+}
+
+static int
+_bench_cork(int cork, uint16_t port, int nconn, int nburst, int nround, int msgsize) {
+    ne = netev_create_flags(nconn+1, 64*1024, cork ? NETEV_CORK : 0);
+    if (netev_add_listen(ne, inet_addr("127.0.0.1"), port, 0, _ck_listencb, NULL) < 0) {
+        printf("listen failed\n");
+        return -1;
+    }
+    uint64_t segs = _tcp_outsegs();
+    uint64_t start = get_usec();
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _ck_client(port, nconn, nburst, nround, msgsize);
+    }
+    int status = 0;
+    while (waitpid(pid, &status, WNOHANG) == 0) {
+        netev_poll(ne, 10);
+    }
+    uint64_t elapse = get_usec() - start;
+    if (elapse == 0)
+        elapse = 1;
+    segs = _tcp_outsegs() - segs;
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    netev_free(ne);
+    ne = NULL;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("client failed\n");
+        return -1;
+    }
+    uint64_t nmsg = (uint64_t)nconn * nburst * nround;
+    printf("%-7s msgs/writev %.1f, tcp segments/msg %.2f (both ends), %.0f msgs/s, sends corked %llu\n",
+            cork ? "cork" : "nocork",
+            st.nwritev ? (double)nmsg / st.nwritev : 0.0,
+            (double)segs / nmsg,
+            nmsg * 1000000.0 / elapse,
+            (unsigned long long)st.ncorked);
+    return 0;
+}
+
+static int
+_cork(int argc, char* argv[]) {
+    int nconn   = argc > 0 ? strtol(argv[0], NULL, 10) : 50;
+    int nburst  = argc > 1 ? strtol(argv[1], NULL, 10) : 16;
+    int nround  = argc > 2 ? strtol(argv[2], NULL, 10) : 2000;
+    int msgsize = argc > 3 ? strtol(argv[3], NULL, 10) : 32;
+    printf("cork: conn %d, burst %d, round %d, msgsize %d\n", nconn, nburst, nround, msgsize);
+    if (_bench_cork(0, 23470, nconn, nburst, nround, msgsize) != 0)
+        return -1;
+    if (_bench_cork(1, 23471, nconn, nburst, nround, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// enough buffers to keep this much in flight, completions only come 
+// once the data is acked
+#define ZC_INFLIGHT (8*1024*1024)
+
+struct zcbuf {
+    char* ptr;
+    int size;
+    int inflight; // sends the kernel still holds
+};
+
+static struct zcbuf* zcbufs = NULL;
+static int zcnbuf = 0;
+
+static void
+_zc_donecb(int fd, int id, void* data, const void* buf) {
+    int i;
+    for (i=0; i<zcnbuf; ++i) {
+        struct zcbuf* b = &zcbufs[i];
+        if ((const char*)buf >= b->ptr && (const char*)buf < b->ptr + b->size) {
+            b->inflight--;
+            return;
+        }
+    }
+}
+
+static void
+_zc_readcb(int fd, int id, void* data) {
+}
+
+static void
+_zc_writecb(int fd, int id, void* data) {
+}
+
+// reads and drops everything, until the peer closes
+static void
+_sink(uint16_t port) {
+    int lfd = socket(AF_INET, SOCK_STREAM, 0);
+    int reuse = 1;
+    setsockopt(lfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (bind(lfd, (struct sockaddr*)&addr, sizeof(addr)) == -1 ||
+        listen(lfd, 1) == -1) {
+        perror("sink");
+        exit(1);
+    }
+    int fd = accept(lfd, NULL, NULL);
+    static char buf[1024*1024];
+    while (read(fd, buf, sizeof(buf)) > 0) {
+    }
+    exit(0);
+}
+
+static int
+_connect_id = -1;
+
+static void
+_zc_connectcb(int fd, int id, void* data, int error) {
+    if (error == 0)
+        _connect_id = id;
+}
+
+static double
+_bench_zerocopy(int id, int zerocopy, int msgsize, int64_t total) {
+    int i;
+    zcnbuf = ZC_INFLIGHT / msgsize;
+    if (zcnbuf < 4)
+        zcnbuf = 4;
+    zcbufs = malloc(zcnbuf * sizeof(struct zcbuf));
+    for (i=0; i<zcnbuf; ++i) {
+        zcbufs[i].ptr = malloc(msgsize);
+        zcbufs[i].size = msgsize;
+        zcbufs[i].inflight = 0;
+        memset(zcbufs[i].ptr, 'z', msgsize);
+    }
+    netev_set_zerocopy(ne, zerocopy ? 1 : 0, _zc_donecb); // every write, remainders too
+    uint64_t start = get_time();
+    int64_t sent = 0;
+    int cur = 0;
+    while (sent < total) {
+        struct zcbuf* b = &zcbufs[cur];
+        if (b->inflight > 0) {
+            netev_poll(ne, 10); // completions
+            continue;
+        }
+        int off = 0;
+        while (off < msgsize) {
+            b->inflight++; // the callback may come before netev_write returns
+            int nbyte = netev_write(ne, id, b->ptr + off, msgsize - off);
+            if (nbyte < 0) {
+                printf("write error %d\n", netev_error(ne));
+                return -1;
+            }
+            if (nbyte == 0 || !zerocopy) {
+                b->inflight--;
+            }
+            if (nbyte == 0) {
+                netev_poll(ne, 10);
+                continue;
+            }
+            off += nbyte;
+        }
+        sent += msgsize;
+        cur = (cur + 1) % zcnbuf;
+    }
+    for (i=0; i<zcnbuf; ++i) {
+        while (zcbufs[i].inflight > 0) {
+            netev_poll(ne, 10);
+        }
+        free(zcbufs[i].ptr);
+    }
+    free(zcbufs);
+    zcbufs = NULL;
+    uint64_t elapse = get_time() - start;
+    if (elapse == 0)
+        elapse = 1;
+    return total / 1048576.0 * 1000.0 / elapse;
+}
+
+static int
+_zerocopy(int argc, char* argv[]) {
+    int64_t total = (argc > 0 ? strtol(argv[0], NULL, 10) : 256) * 1048576LL;
+    uint32_t addr = inet_addr("127.0.0.1");
+    uint16_t port = 23458;
+    pid_t pid = -1;
+    if (argc > 1) {
+        // an external sink, e.g. nc -l 23458 > /dev/null on another host
+        char ip_port[24] = {0};
+        strncpy(ip_port, argv[1], sizeof(ip_port)-1);
+        char* tmp = strchr(ip_port, ':');
+        if (tmp == NULL)
+            return -1;
+        *tmp = '\0';
+        addr = inet_addr(ip_port);
+        port = strtol(tmp+1, NULL, 10);
+    } else {
+        fflush(stdout);
+        pid = fork();
+        if (pid == 0) {
+            _sink(port);
+        }
+        usleep(100000);
+    }
+    ne = netev_create(4, 64*1024);
+    if (netev_connect(ne, addr, port, 1, _zc_connectcb, NULL) != 0 ||
+        _connect_id < 0) {
+        printf("connect sink failed\n");
+        return -1;
+    }
+    netev_add_event(ne, _connect_id, NETEV_READ|NETEV_WRITE, _zc_readcb, _zc_writecb, NULL);
+
+    static const int sizes[] = { 4096, 16384, 65536, 262144, 1048576 };
+    int i;
+    printf("zerocopy: %lld MB per size\n", (long long)(total / 1048576));
+    for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i) {
+        struct netev_stats st0, st1;
+        double copy = _bench_zerocopy(_connect_id, 0, sizes[i], total);
+        netev_stats(ne, &st0);
+        double zc = _bench_zerocopy(_connect_id, 1, sizes[i], total);
+        netev_stats(ne, &st1);
+        if (copy < 0 || zc < 0)
+            return -1;
+        printf("size %8d, copy %8.1f MB/s, zerocopy %8.1f MB/s, zc sends %llu, kernel copied %llu\n",
+                sizes[i], copy, zc, 
+                (unsigned long long)(st1.nzerocopy - st0.nzerocopy),
+                (unsigned long long)(st1.nzerocopy_copied - st0.nzerocopy_copied));
+    }
+    netev_free(ne);
+    ne = NULL;
+    if (pid > 0) 
+        waitpid(pid, NULL, 0);
+    return 0;
+}
+
+// the suite `make bench` runs, for numbers to compare across releases:
+// one CSV row per measurement on stdout, progress on stderr. latencies
+// are ns per op, the micro ones from the time of a batch over its ops
+#define SUITE_BATCH 1024
+
+// a port per run: an io_uring child's listen socket outlives it a little
+static uint16_t suite_port = 23480;
+
+static void
+_row(const char* bench, const char* mode, int param, uint64_t ops, 
+        uint64_t ns, uint64_t bytes, uint64_t* lat, int nlat) {
+    if (ns == 0)
+        ns = 1;
+    double p50 = 0, p99 = 0, p999 = 0;
+    if (nlat > 0) {
+        qsort(lat, nlat, sizeof(uint64_t), _cmp_u64);
+        p50 = lat[nlat / 2] / 1000.0;
+        p99 = lat[(uint64_t)nlat * 99 / 100] / 1000.0;
+        p999 = lat[(uint64_t)nlat * 999 / 1000] / 1000.0;
+    }
+    printf("%s,%s,%d,%llu,%.0f,%.0f,%.3f,%.3f,%.3f\n", bench, mode, param,
+            (unsigned long long)ops, ops * 1e9 / ns, bytes * 1e9 / ns, p50, p99, p999);
+    fflush(stdout);
+}
+
+// alloc, take a buffer the way a read does, free
+static void
+_suite_netbuf(const char* mode, int flags, int nbatch) {
+    struct netbuf* nb = netbuf_create_flags(SUITE_BATCH, 64*1024, flags);
+    if (nb == NULL) {
+        fprintf(stderr, "netbuf %s not available, skipped\n", mode);
+        return;
+    }
+    struct netbuf_block* blocks[SUITE_BATCH];
+    uint64_t* lat = malloc(nbatch * sizeof(uint64_t));
+    uint64_t total = 0;
+    int i, j;
+    for (j=-1; j<nbatch; ++j) {
+        uint64_t start = get_nsec();
+        for (i=0; i<SUITE_BATCH; ++i) {
+            blocks[i] = netbuf_alloc_block(nb, i);
+            netbuf_reserve(nb, blocks[i], 4096);
+        }
+        for (i=0; i<SUITE_BATCH; ++i) {
+            netbuf_free_block(nb, blocks[i]);
+        }
+        uint64_t ns = get_nsec() - start;
+        if (j < 0)
+            continue; // first touch of every block
+        lat[j] = ns / SUITE_BATCH;
+        total += ns;
+    }
+    _row("netbuf_alloc_block", mode, 4096, (uint64_t)nbatch * SUITE_BATCH, total, 0, lat, nbatch);
+    free(lat);
+    netbuf_free(nb);
+}
+
+// u16 framed messages read with netev_read and dropped, timed per read
+// callback over the messages it parsed
+static uint64_t* sr_lat = NULL;
+static int sr_nlat = 0;
+static int sr_cap = 0;
+static uint64_t sr_ns = 0;
+
+static void
+_sr_readcb(int fd, int id, void* data) {
+    uint64_t start = get_nsec();
+    int n = 0;
+    for (;;) {
+        struct msg_header* h = netev_read(ne, id, sizeof(struct msg_header));
+        if (h == NULL)
+            break;
+        void* msg = netev_read(ne, id, h->size);
+        if (msg == NULL)
+            break;
+        netev_dropread(ne, id);
+        n++;
+    }
+    if (n == 0)
+        return;
+    uint64_t ns = get_nsec() - start;
+    nmsg_read += n;
+    sr_ns += ns;
+    if (sr_nlat < sr_cap)
+        sr_lat[sr_nlat++] = ns / n;
+}
+
+static void
+_sr_listencb(int fd, int id) {
+    netev_add_event(ne, id, NETEV_READ, _sr_readcb, NULL, NULL);
+}
+
+static int
+_suite_read(const char* mode, int flags, int nconn, int nmsg, int msgsize) {
+    ne = netev_create_flags(nconn+1, 64*1024, flags);
+    if (ne == NULL) {
+        fprintf(stderr, "netev_read %s not available, skipped\n", mode);
+        return 0;
+    }
+    uint16_t port = suite_port++;
+    if (netev_listen(ne, inet_addr("127.0.0.1"), port, _sr_listencb) != 0) {
+        fprintf(stderr, "listen on %u failed\n", port);
+        return -1;
+    }
+    uint64_t total = (uint64_t)nconn * nmsg;
+    sr_cap = total;
+    sr_lat = malloc(sr_cap * sizeof(uint64_t));
+    sr_nlat = 0;
+    sr_ns = 0;
+    nmsg_read = 0;
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid == 0) {
+        _sender(port, nconn, nmsg, msgsize);
+    }
+    while (nmsg_read < total) {
+        netev_poll(ne, 100);
+    }
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    _row("netev_read", mode, msgsize, total, sr_ns, total * msgsize, sr_lat, sr_nlat);
+    fprintf(stderr, "netev_read %s: %llu bytes moved by compaction\n", mode, 
+            (unsigned long long)st.ncompact);
+    netev_free(ne);
+    ne = NULL;
+    kill(pid, SIGKILL); // past its linger
+    waitpid(pid, NULL, 0);
+    free(sr_lat);
+    sr_lat = NULL;
+    return 0;
+}
+
+// one byte ready on each of nconn connections, the cost of the
+// netev_poll calls that dispatch them all, per event
+static int sd_nread = 0;
+
+static void
+_sd_readcb(int fd, int id, void* data) {
+    if (netev_read(ne, id, 1) != NULL) {
+        netev_dropread(ne, id);
+        sd_nread++;
+    }
+}
+
+static void
+_sd_listencb(int fd, int id) {
+    netev_add_event(ne, id, NETEV_READ, _sd_readcb, NULL, NULL);
+}
+
+// nconn blocking loopback connections to port, -1 where it failed
+static int
+_suite_connect(uint16_t port, int* fds, int nconn) {
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    int i;
+    for (i=0; i<nconn; ++i) {
+        fds[i] = socket(AF_INET, SOCK_STREAM, 0);
+        if (connect(fds[i], (struct sockaddr*)&addr, sizeof(addr)) == -1) {
+            perror("connect");
+            for (; i>=0; --i) {
+                close(fds[i]);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static int
+_suite_dispatch(const char* mode, int flags, int nconn, int nround) {
+    uint16_t port = suite_port++;
+    ne = netev_create_flags(nconn+1, 4096, flags);
+    if (ne == NULL || 
+        netev_listen(ne, inet_addr("127.0.0.1"), port, _sd_listencb) != 0) {
+        fprintf(stderr, "dispatch %s: listen failed\n", mode);
+        return -1;
+    }
+    int* fds = malloc(nconn * sizeof(int));
+    int naccept = 0;
+    int i, j;
+    // the backlog holds them until the accepts below
+    for (i=0; i<nconn; i+=128) {
+        int n = nconn - i < 128 ? nconn - i : 128;
+        if (_suite_connect(port, fds + i, n) != 0)
+            return -1;
+        struct netev_stats st;
+        do {
+            netev_poll(ne, 10);
+            netev_stats(ne, &st);
+        } while (st.naccept < naccept + n);
+        naccept += n;
+    }
+    uint64_t* lat = malloc(nround * sizeof(uint64_t));
+    uint64_t total = 0;
+    for (j=0; j<nround; ++j) {
+        for (i=0; i<nconn; ++i) {
+            if (write(fds[i], "d", 1) != 1) {
+                perror("write");
+                return -1;
+            }
+        }
+        sd_nread = 0;
+        uint64_t start = get_nsec();
+        while (sd_nread < nconn) {
+            netev_poll(ne, 100);
+        }
+        uint64_t ns = get_nsec() - start;
+        lat[j] = ns / nconn;
+        total += ns;
+    }
+    _row("netev_poll_dispatch", mode, nconn, (uint64_t)nconn * nround, total, 0, lat, nround);
+    for (i=0; i<nconn; ++i) {
+        close(fds[i]);
+    }
+    free(fds);
+    free(lat);
+    netev_free(ne);
+    ne = NULL;
+    return 0;
+}
+
+// the end to end peer: echoes every u32 frame, runs until killed
+static void
+_se_listencb(int fd, int id) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    netev_add_frame(ne, id, NETEV_FRAME_U32LE, _ck_echocb, NULL, NULL);
+}
+
+static pid_t
+_suite_server(uint16_t port, int max, int flags) {
+    fflush(stdout);
+    pid_t pid = fork();
+    if (pid != 0)
+        return pid;
+    ne = netev_create_flags(max, 64*1024, flags);
+    if (ne == NULL || netev_add_listen(ne, inet_addr("127.0.0.1"), port, 4096, _se_listencb, NULL) < 0) {
+        fprintf(stderr, "listen on %u failed\n", port);
+        exit(1);
+    }
+    for (;;) {
+        netev_poll(ne, -1);
+    }
+}
+
+static void
+_suite_stop(pid_t pid) {
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+}
+
+static int
+_read_full(int fd, char* buf, int size) {
+    int rsize = 0;
+    while (rsize < size) {
+        int nbyte = read(fd, buf + rsize, size - rsize);
+        if (nbyte <= 0)
+            return -1;
+        rsize += nbyte;
+    }
+    return 0;
+}
+
+// n u32 frames of msgsize back to back
+static char*
+_frames(int n, int msgsize) {
+    int size = (4 + msgsize) * n;
+    char* data = malloc(size);
+    char* p = data;
+    memset(data, 'e', size);
+    int i;
+    for (i=0; i<n; ++i) {
+        uint32_t len = msgsize;
+        memcpy(p, &len, 4); // little endian host
+        p += 4 + msgsize;
+    }
+    return data;
+}
+
+// pipelined echo of a window of frames, at most 64 KB, per round trip
+static int
+_suite_echo(const char* mode, int flags, int msgsize, int nmsg) {
+    uint16_t port = suite_port++;
+    pid_t pid = _suite_server(port, 16, flags);
+    usleep(100000);
+    int fd;
+    if (_suite_connect(port, &fd, 1) != 0) {
+        _suite_stop(pid);
+        return -1;
+    }
+    int window = 64*1024 / (4 + msgsize);
+    if (window < 1)
+        window = 1;
+    int nround = (nmsg + window - 1) / window;
+    int size = (4 + msgsize) * window;
+    char* data = _frames(window, msgsize);
+    char* echo = malloc(size);
+    uint64_t* lat = malloc(nround * sizeof(uint64_t));
+    uint64_t total = 0;
+    int i;
+    for (i=0; i<nround; ++i) {
+        uint64_t start = get_nsec();
+        if (write(fd, data, size) != size || _read_full(fd, echo, size) != 0) {
+            perror("echo");
+            break;
+        }
+        lat[i] = get_nsec() - start;
+        total += lat[i];
+    }
+    close(fd);
+    _suite_stop(pid);
+    uint64_t ops = (uint64_t)i * window;
+    _row("echo", mode, msgsize, ops, total, ops * msgsize, lat, i);
+    free(data);
+    free(echo);
+    free(lat);
+    return i == nround ? 0 : -1;
+}
+
+// connect, one echoed frame, close with a reset so no TIME_WAIT piles up
+static int
+_suite_churn(const char* mode, int flags, int nconn) {
+    uint16_t port = suite_port++;
+    pid_t pid = _suite_server(port, 64, flags);
+    usleep(100000);
+    char* data = _frames(1, 16);
+    char echo[20];
+    uint64_t* lat = malloc(nconn * sizeof(uint64_t));
+    uint64_t total = 0;
+    struct linger lg = { 1, 0 };
+    int i;
+    for (i=0; i<nconn; ++i) {
+        uint64_t start = get_nsec();
+        int fd;
+        if (_suite_connect(port, &fd, 1) != 0)
+            break;
+        int r = write(fd, data, 20) != 20 || _read_full(fd, echo, 20) != 0;
+        setsockopt(fd, SOL_SOCKET, SO_LINGER, &lg, sizeof(lg));
+        close(fd);
+        if (r) {
+            perror("churn");
+            break;
+        }
+        lat[i] = get_nsec() - start;
+        total += lat[i];
+    }
+    _suite_stop(pid);
+    _row("churn", mode, 16, i, total, (uint64_t)i * 16, lat, i);
+    free(data);
+    free(lat);
+    return i == nconn ? 0 : -1;
+}
+
+// nconn connections held open, one of them at random echoes a frame 
+// every gap us. nconn is capped by the fd limit and the port range
+static int
+_suite_idle(const char* mode, int flags, int nconn, int nping, int gap) {
+    uint16_t port = suite_port++;
+    pid_t pid = _suite_server(port, nconn+1, flags|NETEV_POOL);
+    usleep(100000);
+    int* fds = malloc(nconn * sizeof(int));
+    if (_suite_connect(port, fds, nconn) != 0) {
+        _suite_stop(pid);
+        free(fds);
+        return -1;
+    }
+    char* data = _frames(1, 16);
+    char echo[20];
+    uint64_t* lat = malloc(nping * sizeof(uint64_t));
+    uint64_t total = 0;
+    srand(1);
+    int i;
+    for (i=0; i<nping; ++i) {
+        usleep(gap);
+        int fd = fds[rand() % nconn];
+        uint64_t start = get_nsec();
+        if (write(fd, data, 20) != 20 || _read_full(fd, echo, 20) != 0) {
+            perror("idle");
+            break;
+        }
+        lat[i] = get_nsec() - start;
+        total += lat[i];
+    }
+    _suite_stop(pid);
+    _row("idle", mode, nconn, i, total, (uint64_t)i * 16, lat, i);
+    int j;
+    for (j=0; j<nconn; ++j) {
+        close(fds[j]);
+    }
+    free(fds);
+    free(data);
+    free(lat);
+    return i == nping ? 0 : -1;
+}
+
+static int
+_suite(int argc, char* argv[]) {
+    static const int sizes[] = { 64, 512, 4096, 32768 };
+    static const int idle[] = { 10000, 50000 };
+    int maxconn = 28000; // the default ephemeral port range
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+        if (maxconn > (int)rl.rlim_cur - 64)
+            maxconn = rl.rlim_cur - 64;
+    }
+    signal(SIGPIPE, SIG_IGN);
+    batch = 0;
+    printf("bench,mode,param,ops,ops_per_s,bytes_per_s,p50_us,p99_us,p999_us\n");
+
+    fprintf(stderr, "netbuf_alloc_block\n");
+    _suite_netbuf("plain", 0, 2000);
+    _suite_netbuf("mirror", NETBUF_MIRROR, 200);
+    _suite_netbuf("pool", NETBUF_POOL, 2000);
+
+    fprintf(stderr, "netev_read\n");
+    if (_suite_read("plain", 0, 10, 50000, 64) != 0 ||
+        _suite_read("mirror", NETEV_MIRROR, 10, 50000, 64) != 0 ||
+        _suite_read("plain", 0, 10, 5000, 1024) != 0 ||
+        _suite_read("mirror", NETEV_MIRROR, 10, 5000, 1024) != 0)
+        return -1;
+
+    fprintf(stderr, "netev_poll dispatch\n");
+    if (_suite_dispatch("epoll", 0, 1000, 200) != 0 ||
+        _suite_dispatch("uring", NETEV_URING, 1000, 200) != 0)
+        return -1;
+
+    int i;
+    for (i=0; i<sizeof(sizes)/sizeof(sizes[0]); ++i) {
+        fprintf(stderr, "echo %d\n", sizes[i]);
+        int nmsg = 64*1024*1024 / sizes[i];
+        if (nmsg > 500000)
+            nmsg = 500000;
+        if (_suite_echo("epoll", NETEV_CORK, sizes[i], nmsg) != 0 ||
+            _suite_echo("uring", NETEV_URING, sizes[i], nmsg) != 0)
+            return -1;
+    }
+
+    fprintf(stderr, "churn\n");
+    if (_suite_churn("epoll", 0, 5000) != 0 ||
+        _suite_churn("uring", NETEV_URING, 5000) != 0)
+        return -1;
+
+    for (i=0; i<sizeof(idle)/sizeof(idle[0]); ++i) {
+        int nconn = idle[i] < maxconn ? idle[i] : maxconn;
+        if (nconn < idle[i])
+            fprintf(stderr, "idle %d: capped to %d connections by the fd limit\n", idle[i], nconn);
+        else
+            fprintf(stderr, "idle %d\n", nconn);
+        if (_suite_idle("epoll", 0, nconn, 2000, 100) != 0)
+            return -1;
+    }
+    return 0;
+}
+
+// one client pipelines small frames as fast as the server takes them, 
+// the light ones ping one frame at a time: their round trips with and 
+// without a read budget. work_ns of handling per frame on the server
+static int fr_work = 0;
+static uint64_t fr_heavy = 0;
+
+static void
+_fr_echocb(int id, void* msg, int size) {
+    uint64_t until = get_nsec() + fr_work;
+    while (get_nsec() < until)
+        ;
+    if (size != 16)
+        fr_heavy++;
+    netev_send_frame(ne, id, msg, size);
+}
+
+static void
+_fr_listencb(int fd, int id) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    netev_add_frame(ne, id, NETEV_FRAME_U32LE, _fr_echocb, NULL, NULL);
+}
+
+// writes a 64 KB window of frames over and over, reads the echoes away
+static void
+_fr_heavy(uint16_t port, int msgsize) {
+    int fd;
+    if (_suite_connect(port, &fd, 1) != 0)
+        exit(1);
+    fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+    int n = 64*1024 / (4 + msgsize);
+    int size = (4 + msgsize) * n;
+    char* data = _frames(n, msgsize);
+    char buf[64*1024];
+    int off = 0; // the frames repeat, any offset goes on where it left
+    for (;;) {
+        struct pollfd pfd = { fd, POLLIN|POLLOUT, 0 };
+        poll(&pfd, 1, -1);
+        if (pfd.revents & POLLOUT) {
+            int nbyte = write(fd, data + off, size - off);
+            if (nbyte > 0)
+                off = (off + nbyte) % size;
+        }
+        if (pfd.revents & POLLIN) {
+            if (read(fd, buf, sizeof(buf)) == 0)
+                exit(0);
+        }
+        if (pfd.revents & (POLLERR|POLLHUP))
+            exit(0);
+    }
+}
+
+// round trips into rtt, shared with the parent
+static void
+_fr_light(uint16_t port, int nlight, int nping, int gap, uint64_t* rtt) {
+    int* fds = malloc(nlight * sizeof(int));
+    if (_suite_connect(port, fds, nlight) != 0)
+        exit(1);
+    int one = 1;
+    int i;
+    for (i=0; i<nlight; ++i) {
+        setsockopt(fds[i], IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    }
+    char* data = _frames(1, 16);
+    char echo[20];
+    for (i=0; i<nping; ++i) {
+        usleep(gap);
+        int fd = fds[i % nlight];
+        uint64_t start = get_nsec();
+        if (write(fd, data, 20) != 20 || _read_full(fd, echo, 20) != 0)
+            exit(1);
+        rtt[i] = get_nsec() - start;
+    }
+    exit(0);
+}
+
+// the light clients come in on port+1. prio > 0 puts them in 
+// NETEV_PRIO_HIGH and the heavy ones in NETEV_PRIO_BULK, by their listen
+// sockets, prio 2 also weighs bulk at one socket per round
+static int
+_bench_fairness(const char* name, int budget, int prio, uint16_t port, 
+        int nheavy, int nlight, int nping, int msgsize) {
+    ne = netev_create_flags(nlight+nheavy+2, 64*1024, NETEV_CORK);
+    netev_set_read_budget(ne, budget, 0);
+    netev_set_timing(ne, 1);
+    int hl = netev_add_listen(ne, inet_addr("127.0.0.1"), port, 0, _fr_listencb, NULL);
+    int ll = netev_add_listen(ne, inet_addr("127.0.0.1"), port+1, 0, _fr_listencb, NULL);
+    if (hl < 0 || ll < 0) {
+        printf("listen failed\n");
+        return -1;
+    }
+    if (prio > 0) {
+        netev_set_priority(ne, hl, NETEV_PRIO_BULK);
+        netev_set_priority(ne, ll, NETEV_PRIO_HIGH);
+    }
+    if (prio > 1) {
+        int weights[NETEV_NCLASS] = { 0, 0, 0, 1 };
+        netev_set_weights(ne, weights);
+    }
+    uint64_t* rtt = mmap(NULL, nping * sizeof(uint64_t), PROT_READ|PROT_WRITE, 
+            MAP_SHARED|MAP_ANONYMOUS, -1, 0);
+    fflush(stdout);
+    pid_t* heavy = malloc(nheavy * sizeof(pid_t));
+    int i;
+    for (i=0; i<nheavy; ++i) {
+        heavy[i] = fork();
+        if (heavy[i] == 0) {
+            _fr_heavy(port, msgsize);
+        }
+    }
+    // the heavy one gets going first
+    uint64_t start = get_time();
+    while (get_time() - start < 200) {
+        netev_poll(ne, 10);
+    }
+    fr_heavy = 0;
+    start = get_time();
+    pid_t light = fork();
+    if (light == 0) {
+        _fr_light(port+1, nlight, nping, 1000, rtt);
+    }
+    int status = 0;
+    while (waitpid(light, &status, WNOHANG) == 0) {
+        netev_poll(ne, 10);
+    }
+    uint64_t elapse = get_time() - start;
+    if (elapse == 0)
+        elapse = 1;
+    struct netev_stats st;
+    netev_stats(ne, &st);
+    for (i=0; i<nheavy; ++i) {
+        kill(heavy[i], SIGKILL);
+        waitpid(heavy[i], NULL, 0);
+    }
+    free(heavy);
+    netev_free(ne);
+    ne = NULL;
+    if (!WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        printf("light clients failed\n");
+        return -1;
+    }
+    qsort(rtt, nping, sizeof(uint64_t), _cmp_u64);
+    printf("%-12s light rtt p50 %llu us, p99 %llu us, p999 %llu us, max %llu us; "
+            "heavy %.0f msgs/s, parked %llu\n", name,
+            (unsigned long long)rtt[nping / 2] / 1000,
+            (unsigned long long)rtt[nping * 99 / 100] / 1000,
+            (unsigned long long)rtt[nping * 999 / 1000] / 1000,
+            (unsigned long long)rtt[nping - 1] / 1000,
+            fr_heavy * 1000.0 / elapse,
+            (unsigned long long)st.nparked);
+    if (prio > 0) {
+        printf("%-12s queue p99 high %llu us, bulk %llu us; bulk deferred %llu\n", "",
+                (unsigned long long)netev_hist_quantile(st.hist_queue[NETEV_PRIO_HIGH], 0.99) / 1000,
+                (unsigned long long)netev_hist_quantile(st.hist_queue[NETEV_PRIO_BULK], 0.99) / 1000,
+                (unsigned long long)st.ndeferred[NETEV_PRIO_BULK]);
+    }
+    munmap(rtt, nping * sizeof(uint64_t));
+    return 0;
+}
+
+static int
+_fairness(int argc, char* argv[]) {
+    int nlight  = argc > 0 ? strtol(argv[0], NULL, 10) : 50;
+    int nping   = argc > 1 ? strtol(argv[1], NULL, 10) : 2000;
+    int msgsize = argc > 2 ? strtol(argv[2], NULL, 10) : 64;
+    int budget  = argc > 3 ? strtol(argv[3], NULL, 10) : 16;
+    fr_work     = argc > 4 ? strtol(argv[4], NULL, 10) : 1000;
+    printf("fairness: light conn %d, pings %d, heavy msgsize %d, budget %d frames, work %d ns/frame\n",
+            nlight, nping, msgsize, budget, fr_work);
+    char name[32];
+    snprintf(name, sizeof(name), "budget %d", budget);
+    if (_bench_fairness("budget none", 0, 0, 23472, 1, nlight, nping, msgsize) != 0)
+        return -1;
+    if (_bench_fairness(name, budget, 0, 23474, 1, nlight, nping, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// fairness with several heavy clients, the light ones in a higher class
+static int
+_priority(int argc, char* argv[]) {
+    int nheavy  = argc > 0 ? strtol(argv[0], NULL, 10) : 4;
+    int nlight  = argc > 1 ? strtol(argv[1], NULL, 10) : 50;
+    int nping   = argc > 2 ? strtol(argv[2], NULL, 10) : 2000;
+    int msgsize = argc > 3 ? strtol(argv[3], NULL, 10) : 64;
+    fr_work     = argc > 4 ? strtol(argv[4], NULL, 10) : 1000;
+    printf("priority: heavy conn %d, light conn %d, pings %d, heavy msgsize %d, work %d ns/frame\n",
+            nheavy, nlight, nping, msgsize, fr_work);
+    if (_bench_fairness("none", 0, 0, 23462, nheavy, nlight, nping, msgsize) != 0)
+        return -1;
+    if (_bench_fairness("classes", 0, 1, 23464, nheavy, nlight, nping, msgsize) != 0)
+        return -1;
+    if (_bench_fairness("weighted", 0, 2, 23466, nheavy, nlight, nping, msgsize) != 0)
+        return -1;
+    return 0;
+}
+
+// the cork echo on a netgroup of 1, 2, 4 .. loops, the same clients 
+// each time: throughput against thread count
+static __thread struct netev* gr_ne = NULL;
+
+static void
+_gr_echocb(int id, void* msg, int size) {
+    netev_send_frame(gr_ne, id, msg, size);
+}
+
+static void
+_gr_listencb(int fd, int id) {
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    netev_add_frame(gr_ne, id, NETEV_FRAME_U32LE, _gr_echocb, NULL, NULL);
+}
+
+static void
+_gr_initcb(struct netev* ne, int index, void* ud) {
+    gr_ne = ne;
+}
+
+static int
+_bench_group(int nthread, uint16_t port, int nclient, int nconn, int nburst, int nround,
+        int msgsize, double* rate) {
+    struct netgroup* g = netgroup_create(nthread, nconn+1, 64*1024, 0);
+    if (g == NULL) {
+        printf("netgroup failed\n");
+        return -1;
+    }
+    if (netgroup_listen(g, inet_addr("127.0.0.1"), port, 0, _gr_listencb, NULL) != 0) {
+        printf("listen on %u failed\n", port);
+        netgroup_free(g);
+        return -1;
+    }
+    if (netgroup_start(g, NULL, _gr_initcb, NULL, NULL) != 0) {
+        printf("netgroup start failed\n");
+        netgroup_free(g);
+        return -1;
+    }
+    fflush(stdout);
+    pid_t pids[nclient];
+    int i;
+    uint64_t start = get_usec();
+    for (i=0; i<nclient; ++i) {
+        pids[i] = fork();
+        if (pids[i] == 0) {
+            _ck_client(port, nconn / nclient, nburst, nround, msgsize);
+        }
+    }
+    int failed = 0;
+    for (i=0; i<nclient; ++i) {
+        int status = 0;
+        waitpid(pids[i], &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+            failed = 1;
+    }
+    uint64_t elapse = get_usec() - start;
+    if (elapse == 0)
+        elapse = 1;
+    netgroup_stop(g);
+    char spread[256];
+    int len = 0;
+    for (i=0; i<nthread && len < (int)sizeof(spread) - 16; ++i) {
+        struct netev_stats st;
+        netev_stats(netgroup_netev(g, i), &st);
+        len += snprintf(spread + len, sizeof(spread) - len, "%s%llu", i ? "/" : "",
+                (unsigned long long)st.naccept);
+    }
+    netgroup_free(g);
+    if (failed) {
+        printf("client failed\n");
+        return -1;
+    }
+    uint64_t nmsg = (uint64_t)(nconn / nclient) * nclient * nburst * nround;
+    *rate = nmsg * 1000000.0 / elapse;
+    printf("threads %-3d %.0f msgs/s, connections per loop %s\n", nthread, *rate, spread);
+    return 0;
+}
+
+static int
+_group(int argc, char* argv[]) {
+    int ncpu     = sysconf(_SC_NPROCESSORS_ONLN);
+    int nmax     = argc > 0 ? strtol(argv[0], NULL, 10) : (ncpu > 1 ? ncpu / 2 : 1);
+    int nconn    = argc > 1 ? strtol(argv[1], NULL, 10) : 64;
+    int nround   = argc > 2 ? strtol(argv[2], NULL, 10) : 1000;
+    int msgsize  = argc > 3 ? strtol(argv[3], NULL, 10) : 32;
+    int nclient  = 4;
+    int nburst   = 16;
+    printf("group: cpus %d, conn %d, clients %d, burst %d, round %d, msgsize %d\n",
+            ncpu, nconn, nclient, nburst, nround, msgsize);
+    double base = 0;
+    int n;
+    for (n=1; n<=nmax; n*=2) {
+        double rate = 0;
+        if (_bench_group(n, 23480 + n, nclient, nconn, nburst, nround, msgsize, &rate) != 0)
+            return -1;
+        if (n == 1)
+            base = rate;
+        else
+            printf("%-11s %.2fx one loop\n", "", rate / base);
+    }
+    return 0;
+}
+
+int
+main(int argc, char* argv[]) {
+    if (argc < 2) {
+        printf("usage: %s edge [nconn nmsg msgsize batch]\n", argv[0]);
+        printf("       %s zerocopy [MB per size] [sink ip:port]\n", argv[0]);
+        printf("       %s mirror [nconn nmsg msgsize]\n", argv[0]);
+        printf("       %s pool [nconn nmsg msgsize]\n", argv[0]);
+        printf("       %s arena [nconn nmsg msgsize block_size numa_node]\n", argv[0]);
+        printf("       %s broadcast [nconn nmsg msgsize]\n", argv[0]);
+        printf("       %s unix [nping nmsg msgsize]\n", argv[0]);
+        printf("       %s busypoll [nping gap_us spin_us]\n", argv[0]);
+        printf("       %s cork [nconn nburst nround msgsize]\n", argv[0]);
+        printf("       %s fairness [nlight nping msgsize budget work_ns]\n", argv[0]);
+        printf("       %s priority [nheavy nlight nping msgsize work_ns]\n", argv[0]);
+        printf("       %s group [max_threads nconn nround msgsize]\n", argv[0]);
+        printf("       %s suite, CSV on stdout\n", argv[0]);
+        return -1;
+    }
+    if (strcmp(argv[1], "edge") == 0) {
+        return _edge(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "zerocopy") == 0) {
+        return _zerocopy(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "mirror") == 0) {
+        return _mirror(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "pool") == 0) {
+        return _pool(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "arena") == 0) {
+        return _arena(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "broadcast") == 0) {
+        return _broadcast(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "unix") == 0) {
+        return _unix(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "busypoll") == 0) {
+        return _busypoll(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "cork") == 0) {
+        return _cork(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "fairness") == 0) {
+        return _fairness(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "priority") == 0) {
+        return _priority(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "group") == 0) {
+        return _group(argc-2, argv+2);
+    }
+    if (strcmp(argv[1], "suite") == 0) {
+        return _suite(argc-2, argv+2);
+    }
+    printf("unknown benchmark %s\n", argv[1]);
+    return -1;
+}
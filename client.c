@@ -1,5 +1,4 @@
 #include "netev.h"
-#include "netbuf.h"
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
@@ -19,14 +18,14 @@ struct msg_header {
 
 struct client {
     int conn_id;
-    struct netbuf_block* wbuf_b;
+    int active;
     int stat_read;
     int stat_write;
+    int last_read; // udp: stat_read at the last tick
 };
 
 struct server {
     struct netev* ne;
-    struct netbuf* wbuf; 
     struct client* clients;
     struct client* free_client;
 
@@ -43,15 +42,23 @@ struct server {
 static struct server* s = NULL;
 static int package_size = 1024;
 
+// udp mode: each client is a socket of its own keeping window datagrams
+// in flight, an echo is answered with the next one
+static int udp = 0; // 0 tcp, else netev_udp flags + 1
+static int window = 64;
+static uint32_t server_addr;
+static uint16_t server_port;
+
 static struct client*
 _alloc_clients(int max) {
     int i;
     struct client* c = malloc(max * sizeof(struct client));
     for (i=0; i<max; ++i) {
         c[i].conn_id = i+1;
-        c[i].wbuf_b = NULL;
+        c[i].active = 0;
         c[i].stat_read = 0;
         c[i].stat_write = 0;
+        c[i].last_read = 0;
     }
     c[max-1].conn_id = -1;
     return c;
@@ -70,7 +77,7 @@ _create_client(struct server* s, int conn_id) {
         s->free_client = &s->clients[next];
 
     c->conn_id = conn_id;
-    c->wbuf_b = netbuf_alloc_block(s->wbuf, c - s->clients);
+    c->active = 1;
     return c;
 }
 
@@ -82,8 +89,7 @@ _free_client(struct server* s, struct client* c) {
     } else {
         c->conn_id = free - s->clients;
     }
-    netbuf_free_block(s->wbuf, c->wbuf_b);
-    c->wbuf_b = NULL;
+    c->active = 0;
     c->stat_read = 0;
     c->stat_write = 0;
     s->free_client = c;
@@ -91,124 +97,35 @@ _free_client(struct server* s, struct client* c) {
 
 static inline int 
 _is_client_closed(struct client* c) {
-    return c->wbuf_b == NULL;
+    return !c->active;
 }
 
-void
-writecb(int fd, int id, void* data) {
-    struct client* c = data;
+// the echo of one of our frames
+static void
+msgcb(int id, void* msg, int size) {
+    struct client* c = netev_data(s->ne, id);
     if (c == NULL) {
-        printf("id %d, NULL client write\n", id);
+        printf("id %d, NULL client read\n", id);
         return;
     }
-
-    struct netbuf_block* wbuf_b = c->wbuf_b;
-    if (wbuf_b->roffset == wbuf_b->woffset) {
-        return; // empty
-    }
-    int error;
-    if (wbuf_b->roffset < wbuf_b->woffset) {
-        void* buf = (void*)wbuf_b + sizeof(*wbuf_b) + wbuf_b->roffset;
-        int nbyte = netev_write(s->ne, id, buf, wbuf_b->woffset - wbuf_b->roffset);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte > 0) {
-            wbuf_b->roffset += nbyte;
-            c->stat_write += nbyte;
-            goto out;
-        }
-    } else {
-        void* begin = (void*)wbuf_b + sizeof(*wbuf_b);
-        void* buf = begin + wbuf_b->roffset;
-        int wsize = wbuf_b->size - wbuf_b->roffset;
-        int nbyte = netev_write(s->ne, id, buf, wsize);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte == 0) {
-            goto out;
-        }
-        c->stat_write += nbyte;
-        if (nbyte < wsize) {
-            wbuf_b->roffset += nbyte;
-            goto out;
-        }
-        wbuf_b->roffset = 0;
-        wsize = wbuf_b->woffset;
-        if (wsize == 0) { 
-            goto out;
-        }
-        nbyte = netev_write(s->ne, id, begin, wsize);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte > 0) {
-            wbuf_b->roffset += nbyte;
-            c->stat_write += nbyte;
-            goto out;
-        } 
+    assert(size == package_size);
+    uint32_t* text = msg;
+    int i;
+    for (i=0; i<size/sizeof(text[0]); ++i) {
+        assert(text[i] == id);
     }
-out:
-    //printf("write size=%d, woffset=%d roffset=%d\n", 
-            //c->stat_write - oldstat, wbuf_b->woffset, wbuf_b->roffset);
-    return;
-err_out:
-    error = netev_error(s->ne);
-    printf("client %d, write occur error %d\n", id, error);
-    _free_client(s, c);
-    s->nclosedwrite +=1;
+    //printf("from client %d, read msg size=%d\n", id, size);
+    s->rstat += 1;
 }
 
-void
-readcb(int fd, int id, void* data) {
+static void
+closecb(int fd, int id, void* data, int error) {
     struct client* c = data;
-    if (c == NULL) {
-        printf("id %d, NULL client read\n", id);
+    if (c == NULL)
         return;
-    }
-
-    int error = NETEV_OK;
-    for (;;) {
-        struct msg_header* h = netev_read(s->ne, id, sizeof(struct msg_header));
-        if (h == NULL) {
-            error = netev_error(s->ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-        assert(h->size == package_size);
-        
-        uint32_t* msg = netev_read(s->ne, id, h->size);
-        if (msg == NULL) {
-            error = netev_error(s->ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-        int i;
-        for (i=0; i<h->size/sizeof(msg[0]); ++i) {
-            assert(msg[i] == id);
-        }
-        //printf("from client %d, read msg size=%d\n", id, h->size);
-
-        //_handle_msg(c, (void*)h, sizeof(*h) + h->size);
-
-        netev_dropread(s->ne, id);
-
-        s->rstat += 1;
-    }
-out:
-    return;
-err_out:
-    printf("client %d read occur error %d\n", id, error);
+    printf("client %d closed, error %d\n", id, error);
     _free_client(s, c);
     s->nclosedread +=1;
-    return;
 }
 
 void 
@@ -227,13 +144,64 @@ _connectcb(int fd, int id, void* data, int error) {
         s->nconnected += 1;
         struct client* c = _create_client(s, id);
         assert(c);
-        netev_add_event(s->ne, id, NETEV_READ|NETEV_WRITE, readcb, writecb, c);
+        netev_add_frame(s->ne, id, NETEV_FRAME_U16LE, msgcb, NULL, c);
     } else {
         s->nconnectfail += 1;
         printf("connect failed %u, %s\n", error, strerror(error));
     }
 }
 
+static inline int
+_send_dgram(struct client* c) {
+    uint32_t text[package_size/sizeof(uint32_t) + 1];
+    memset(text, 0, package_size);
+    text[0] = c->conn_id;
+    if (netev_sendto(s->ne, c->conn_id, text, package_size, server_addr, server_port) != 0)
+        return -1;
+    c->stat_write += 1;
+    s->wstat += 1;
+    return 0;
+}
+
+// the echo of one of our datagrams
+static void
+_dgramcb(int id, const void* msg, int size, uint32_t addr, uint16_t port, void* data) {
+    struct client* c = data;
+    assert(size == package_size);
+    assert(*(const uint32_t*)msg == id);
+    c->stat_read += 1;
+    s->rstat += 1;
+    _send_dgram(c);
+}
+
+// a window lost on the way is sent again
+static void
+_fill_window(struct client* c) {
+    int i;
+    for (i=0; i<window; ++i) {
+        if (_send_dgram(c) != 0)
+            break;
+    }
+}
+
+int
+_start_udp(int max) {
+    int i;
+    for (i=0; i<max; ++i) {
+        struct client* c = _create_client(s, -1);
+        assert(c);
+        int id = netev_udp(s->ne, INADDR_ANY, 0, udp - 1, _dgramcb, c);
+        if (id < 0) {
+            _free_client(s, c);
+            return -1;
+        }
+        c->conn_id = id;
+        s->nconnected += 1;
+        _fill_window(c);
+    }
+    return 0;
+}
+
 int
 _start_connect(uint32_t addr, uint16_t port, int max) {
     int i;
@@ -248,40 +216,13 @@ _start_connect(uint32_t addr, uint16_t port, int max) {
 
 static inline int
 _start_write_client(struct client* c, void* msg, int size) {
-    struct netbuf_block* wbuf_b = c->wbuf_b;
-    int space;
-    if (wbuf_b->roffset > wbuf_b->woffset)
-        space = wbuf_b->roffset - wbuf_b->woffset;
-    else
-        space = wbuf_b->size + wbuf_b->roffset - wbuf_b->woffset;
-    space -= 1;
-    if (space < size) {
-        printf("client %d no wbuf space:%d < size:%d\n", c->conn_id, space, size);
+    if (netev_send_frame(s->ne, c->conn_id, msg, size) != 0) {
+        printf("client %d send error %d, pending %d\n", c->conn_id, 
+                netev_error(s->ne), netev_sendsize(s->ne, c->conn_id));
         return -1; // full
     }
-    void* begin = (void*)wbuf_b + sizeof(*wbuf_b);
-    void* buf = begin + wbuf_b->woffset;
-
-    int size1 = wbuf_b->size - wbuf_b->woffset;
-    int size2 = 0;
-    if (size1 >= size) {
-        size1 = size;
-    } else {
-        size2 = size - size1;
-    }
-    memcpy(buf, msg, size1);
-    if (size2) {
-        memcpy(begin, msg+size1, size2);
-        wbuf_b->woffset = size2;
-    } else {
-        wbuf_b->woffset += size1;
-        if (wbuf_b->woffset == wbuf_b->size)
-            wbuf_b->woffset = 0;
-    }
-    c->stat_read+=size;
+    c->stat_write += size + sizeof(struct msg_header);
     s->wstat += 1;
-    //printf("to client %d, write msg size=%d, woffset=%d roffset=%d\n", 
-            //c->conn_id, size, wbuf_b->woffset, wbuf_b->roffset);
     return 0;
 }
 
@@ -290,19 +231,16 @@ void
 _start_write(struct server* s) {
     int i;
     int j;
-    int size = package_size + sizeof(struct msg_header);
-    char data[size];
-    struct msg_header* m = (struct msg_header*)data;
-    m->size = package_size;
+    uint32_t text[package_size/sizeof(uint32_t) + 1];
 
     for (i=0; i<s->max; ++i) {
         struct client* c = &s->clients[i];
         if (_is_client_closed(c)) 
             continue;
-        for (j=0; j<m->size/sizeof(m->text[0]); ++j) {
-            m->text[j] = c->conn_id;
+        for (j=0; j<package_size/sizeof(text[0]); ++j) {
+            text[j] = c->conn_id;
         }
-        if (_start_write_client(c, m, size) != 0) {
+        if (_start_write_client(c, text, package_size) != 0) {
             netev_close_socket(s->ne, c->conn_id);
             _free_client(s, c); 
             s->nclosedwrite +=1;
@@ -310,6 +248,27 @@ _start_write(struct server* s) {
     }
 }
 
+// a burst every 100ms
+static void
+_write_timer(int id, void* data) {
+    struct server* s = data;
+    printf("max %d, connect %d, fail %d, wclose %d, rclose %d,  wstat %d, rstat %d\n", 
+            s->max, s->nconnected, s->nconnectfail, s->nclosedwrite, s->nclosedread, s->wstat, s->rstat);
+    if (!udp) {
+        _start_write(s);
+        return;
+    }
+    int i;
+    for (i=0; i<s->max; ++i) {
+        struct client* c = &s->clients[i];
+        if (_is_client_closed(c))
+            continue;
+        if (c->stat_read == c->last_read)
+            _fill_window(c);
+        c->last_read = c->stat_read;
+    }
+}
+
 static void 
 _sigint_handler() {
     printf("sig int\n");
@@ -319,7 +278,7 @@ _sigint_handler() {
 int 
 main(int argc, char* argv[]) {
     if (argc < 2) {
-        printf("usage: %s ip:port\n", argv[0]);
+        printf("usage: %s ip:port [max] [buf_size] [package_size] [tcp|udp|udp-gso] [window]\n", argv[0]);
         return -1;
     }
 
@@ -349,12 +308,20 @@ main(int argc, char* argv[]) {
     if (argc > 4)
         package_size = strtol(argv[4], NULL, 10);
 
+    if (argc > 5 && strcmp(argv[5], "udp") == 0)
+        udp = 1;
+    else if (argc > 5 && strcmp(argv[5], "udp-gso") == 0)
+        udp = 1 + (NETEV_UDP_GSO|NETEV_UDP_GRO);
+
+    if (argc > 6)
+        window = strtol(argv[6], NULL, 10);
+
     struct netev* ne = netev_create(max, 64*1024); 
-    struct netbuf* wbuf = netbuf_create(max, buf_size*1024);
+    netev_set_send_limit(ne, buf_size*1024);
+    netev_set_closecb(ne, closecb);
 
     s = malloc(sizeof(struct server));
     s->ne = ne;
-    s->wbuf = wbuf; 
     s->clients = _alloc_clients(max);
     s->free_client = &s->clients[0];
     s->max = max;
@@ -365,21 +332,19 @@ main(int argc, char* argv[]) {
     s->rstat = 0;
     s->wstat = 0;
     printf("connect to %s\n", argv[1]);
-    if (_start_connect(addr, port, max) != 0) {
+    server_addr = addr;
+    server_port = port;
+    if ((udp ? _start_udp(max) : _start_connect(addr, port, max)) != 0) {
         printf("connect failed\n");
         return -1;
     }
 
     signal(SIGINT, _sigint_handler);
+    netev_add_timer(ne, 100, 100, _write_timer, s);
     for (;;) {
-        int nfd = netev_poll(s->ne, 1);
-        usleep(100000);
-        printf("nfd %d, max %d, connect %d, fail %d, wclose %d, rclose %d,  wstat %d, rstat %d\n", 
-                nfd, s->max, s->nconnected, s->nconnectfail, s->nclosedwrite, s->nclosedread, s->wstat, s->rstat);
-        _start_write(s);
+        netev_poll(s->ne, -1);
     }
     netev_free(s->ne);
-    netbuf_free(s->wbuf);
     free(s->clients);
     free(s);
     return 0;
@@ -7,10 +7,6 @@
 #include <unistd.h>
 
 #pragma pack(1)
-struct msg_header {
-    uint16_t size;
-};
-
 struct msg {
     uint16_t size;
     char text[1024];
@@ -20,36 +16,13 @@ struct msg {
 static struct netev* ne = NULL;
 
 void
-readcb(int fd, int id, void* data) {
-    int error = NETEV_OK;
-    for (;;) {
-        struct msg_header* h = netev_read(ne, id, sizeof(struct msg_header));
-        if (h == NULL) {
-            error = netev_error(ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-        void* msg = netev_read(ne, id, h->size);
-        if (msg == NULL) {
-            error = netev_error(ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-        printf("client %d read msg size=%d\n", id, h->size);
-        netev_dropread(ne, id);
-    }
-out:
-    return;
-err_out:
+msgcb(int id, void* msg, int size) {
+    printf("client %d read msg size=%d\n", id, size);
+}
+
+void
+closecb(int fd, int id, void* data, int error) {
     printf("client %d read occur error %d\n", id, error);
-    netev_close_socket(ne, id);
-    return;
 }
 
 void 
@@ -96,7 +69,7 @@ _connectcb(int fd, int id, void* data, int error) {
         printf("connect failed %u, %s\n", error, strerror(error));
 
     if (error == 0)
-        netev_add_event(ne, id, NETEV_READ|NETEV_WRITE, readcb, writecb, NULL);
+        netev_add_frame(ne, id, NETEV_FRAME_U16LE, msgcb, writecb, NULL);
 }
 
 int 
@@ -131,6 +104,7 @@ main(int argc, char* argv[]) {
 
 
     ne = netev_create(max, buf_size*1024);
+    netev_set_closecb(ne, closecb);
   
     printf("connect to %s\n", argv[1]);
 
@@ -67,7 +67,7 @@ main(int argc, char* argv[]) {
         *tmp = '\0';
         addr = inet_addr(ip_port);
     }
-    ne = netev_create(10, 64*1024);
+    ne = netev_create(10+1, 64*1024); // and the listen socket
     
     int r = netev_listen(ne, addr, port, listencb);
     if (r != 0) {
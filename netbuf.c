@@ -1,20 +1,88 @@
+#define _GNU_SOURCE
 #include "netbuf.h"
 #include <stdlib.h>
+#include <string.h>
 #include <assert.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#ifndef MPOL_BIND
+#define MPOL_BIND 2
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+#define HUGEPAGE_SIZE (2*1024*1024)
+
+#define POOL_MIN    4096
+#define POOL_NCLASS 16
+#define POOL_KEEP   (1024*1024) // idle bytes a class keeps, one buffer at least
+
+// the owning loop thread is the only writer, a relaxed store keeps each
+// counter whole for netbuf_stats on another thread
+#define STAT_ADD(self, field, n) \
+    __atomic_store_n(&(self)->stats.field, (self)->stats.field + (n), __ATOMIC_RELAXED)
+
+struct netbuf_class {
+    int size;
+    int nfree;
+    int keep;   // most buffers on the free list, the rest go back to malloc
+    void* free; // buffers linked through their first bytes
+};
 
 struct netbuf {
     int max;
     int block_size;
-    char blocks[0];
+    int flags;
+    int fd;                      // NETBUF_MIRROR: memfd behind every ring
+    char* ring;                  // NETBUF_MIRROR: 2 * block_size per id
+    struct netbuf_block* heads;  // NETBUF_MIRROR, NETBUF_POOL
+    int nclass;                  // NETBUF_POOL
+    struct netbuf_class class[POOL_NCLASS];
+    struct netbuf_stats stats;
+    char* blocks;
+    size_t arena_size;           // mmap'd arena, 0 if malloc'd
 };
 
+// both halves of the ring onto the id's pages, once per id
+static int
+_mirror_map(struct netbuf* self, int id) {
+    size_t size = self->block_size;
+    char* addr = self->ring + (size_t)id * 2 * size;
+    off_t off = (off_t)id * size;
+    if (mmap(addr, size, PROT_READ|PROT_WRITE, 
+            MAP_SHARED|MAP_FIXED, self->fd, off) == MAP_FAILED)
+        return -1;
+    if (mmap(addr + size, size, PROT_READ|PROT_WRITE, 
+            MAP_SHARED|MAP_FIXED, self->fd, off) == MAP_FAILED)
+        return -1;
+    self->heads[id].data = addr;
+    return 0;
+}
+
 struct netbuf_block* 
 netbuf_alloc_block(struct netbuf* self, int id) {
     assert(id >= 0 && id < self->max);
-    struct netbuf_block* buf_b =  (void*)self->blocks + id * self->block_size;
-    buf_b->size = self->block_size - sizeof(*buf_b);
+    struct netbuf_block* buf_b;
+    if (self->flags & NETBUF_MIRROR) {
+        buf_b = &self->heads[id];
+        if (buf_b->data == NULL && _mirror_map(self, id) == -1)
+            return NULL;
+        buf_b->size = self->block_size;
+    } else if (self->flags & NETBUF_POOL) {
+        buf_b = &self->heads[id];
+        buf_b->size = 0;
+        buf_b->data = NULL;
+    } else {
+        buf_b = (void*)self->blocks + (size_t)id * self->block_size;
+        buf_b->size = self->block_size - sizeof(*buf_b);
+        buf_b->data = (char*)(buf_b + 1);
+    }
     buf_b->roffset = 0;
     buf_b->woffset = 0;
+    buf_b->base = 0;
     return buf_b;
 }
 
@@ -22,19 +90,303 @@ void
 netbuf_free_block(struct netbuf* self, struct netbuf_block* block) {
     block->roffset = 0;
     block->woffset = 0;
+    block->base = 0;
+    netbuf_release(self, block);
+}
+
+static inline struct netbuf_class*
+_class_of(struct netbuf* self, int size) {
+    int i;
+    for (i=0; i<self->nclass-1; ++i) {
+        if (self->class[i].size >= size)
+            break;
+    }
+    return &self->class[i];
+}
+
+static inline void
+_pool_put(struct netbuf* self, char* data, int size) {
+    struct netbuf_class* c = _class_of(self, size);
+    STAT_ADD(self, inuse, -size);
+    if (c->nfree >= c->keep) {
+        free(data); // past a burst, memory follows what is buffered now
+        return;
+    }
+    *(void**)data = c->free;
+    c->free = data;
+    c->nfree++;
+}
+
+int
+netbuf_reserve(struct netbuf* self, struct netbuf_block* block, int need) {
+    if (need <= block->size && block->data)
+        return 0;
+    if (!(self->flags & NETBUF_POOL) || need > self->block_size)
+        return -1;
+    struct netbuf_class* c = _class_of(self, need > 0 ? need : 1);
+    char* data = c->free;
+    if (data) {
+        c->free = *(void**)data;
+        c->nfree--;
+        STAT_ADD(self, nhit, 1);
+    } else {
+        data = malloc(c->size);
+        STAT_ADD(self, nmiss, 1);
+    }
+    STAT_ADD(self, inuse, c->size);
+    if (self->stats.inuse > self->stats.highwater)
+        __atomic_store_n(&self->stats.highwater, self->stats.inuse, __ATOMIC_RELAXED);
+    if (block->data) {
+        int live = block->woffset - block->base;
+        memcpy(data, block->data + block->base, live);
+        _pool_put(self, block->data, block->size);
+        block->roffset -= block->base;
+        block->woffset = live;
+        block->base = 0;
+    }
+    block->data = data;
+    block->size = c->size;
+    return 0;
+}
+
+void
+netbuf_release(struct netbuf* self, struct netbuf_block* block) {
+    if (!(self->flags & NETBUF_POOL) || block->data == NULL ||
+        block->woffset != block->base)
+        return;
+    _pool_put(self, block->data, block->size);
+    block->data = NULL;
+    block->size = 0;
+    block->roffset = 0;
+    block->woffset = 0;
+    block->base = 0;
+}
+
+int
+netbuf_limit(struct netbuf* self) {
+    if (self->flags & (NETBUF_MIRROR|NETBUF_POOL))
+        return self->block_size;
+    return self->block_size - sizeof(struct netbuf_block);
+}
+
+void
+netbuf_stats(struct netbuf* self, struct netbuf_stats* st) {
+    st->nhit = __atomic_load_n(&self->stats.nhit, __ATOMIC_RELAXED);
+    st->nmiss = __atomic_load_n(&self->stats.nmiss, __ATOMIC_RELAXED);
+    st->inuse = __atomic_load_n(&self->stats.inuse, __ATOMIC_RELAXED);
+    st->highwater = __atomic_load_n(&self->stats.highwater, __ATOMIC_RELAXED);
+}
+
+int
+netbuf_drop(struct netbuf* self, struct netbuf_block* block) {
+    int size = block->woffset - block->roffset;
+    assert(size >= 0);
+    if (self->flags & NETBUF_MIRROR) {
+        block->base = block->roffset;
+        if (block->base >= block->size) {
+            block->base -= block->size;
+            block->roffset -= block->size;
+            block->woffset -= block->size;
+        }
+        return 0;
+    }
+    if (block->roffset == 0)
+        return 0;
+    if (size > 0)
+        memmove(block->data, block->data + block->roffset, size);
+    block->woffset = size;
+    block->roffset = 0;
+    return size;
+}
+
+static struct netbuf*
+_create_mirror(int max, int block_size) {
+    long page = sysconf(_SC_PAGESIZE);
+    block_size = (block_size + page - 1) / page * page;
+    int fd = memfd_create("netbuf", MFD_CLOEXEC);
+    if (fd == -1)
+        return NULL;
+    if (ftruncate(fd, (off_t)max * block_size) == -1) {
+        close(fd);
+        return NULL;
+    }
+    // address space only, the rings are mapped in as ids are first used
+    size_t size = (size_t)max * 2 * block_size;
+    char* ring = mmap(NULL, size, PROT_NONE, 
+            MAP_PRIVATE|MAP_ANONYMOUS|MAP_NORESERVE, -1, 0);
+    if (ring == MAP_FAILED) {
+        close(fd);
+        return NULL;
+    }
+    struct netbuf* nb = malloc(sizeof(struct netbuf));
+    nb->max = max;
+    nb->block_size = block_size;
+    nb->flags = NETBUF_MIRROR;
+    nb->fd = fd;
+    nb->ring = ring;
+    nb->heads = calloc(max, sizeof(struct netbuf_block));
+    nb->blocks = NULL;
+    nb->arena_size = 0;
+    nb->nclass = 0;
+    memset(&nb->stats, 0, sizeof(nb->stats));
+    return nb;
+}
+
+static struct netbuf*
+_create_pool(int max, int block_size) {
+    struct netbuf* nb = malloc(sizeof(struct netbuf));
+    nb->max = max;
+    nb->block_size = block_size;
+    nb->flags = NETBUF_POOL;
+    nb->fd = -1;
+    nb->ring = NULL;
+    nb->heads = calloc(max, sizeof(struct netbuf_block));
+    nb->blocks = NULL;
+    nb->arena_size = 0;
+    nb->nclass = 0;
+    int size = POOL_MIN;
+    while (size < block_size && nb->nclass < POOL_NCLASS-1) {
+        nb->class[nb->nclass].size = size;
+        nb->nclass++;
+        size *= 2;
+    }
+    nb->class[nb->nclass].size = block_size;
+    nb->nclass++;
+    int i;
+    for (i=0; i<nb->nclass; ++i) {
+        struct netbuf_class* c = &nb->class[i];
+        c->nfree = 0;
+        c->keep = POOL_KEEP / c->size > 0 ? POOL_KEEP / c->size : 1;
+        c->free = NULL;
+    }
+    memset(&nb->stats, 0, sizeof(nb->stats));
+    return nb;
+}
+
+static int
+_arena_bind(char* arena, size_t size, int node) {
+    unsigned long mask[16];
+    if (node < 0 || node >= sizeof(mask) * 8)
+        return -1;
+    memset(mask, 0, sizeof(mask));
+    mask[node / (sizeof(mask[0]) * 8)] = 1UL << (node % (sizeof(mask[0]) * 8));
+    return syscall(SYS_mbind, arena, size, MPOL_BIND, mask, sizeof(mask) * 8, 0);
+}
+
+// hugetlb pages first, then transparent ones on a 2 MB aligned range
+static char*
+_arena_map(size_t size, int hugepage) {
+    char* arena;
+    if (hugepage) {
+        arena = mmap(NULL, size, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+        if (arena != MAP_FAILED)
+            return arena;
+        size_t len = size + HUGEPAGE_SIZE;
+        char* p = mmap(NULL, len, PROT_READ|PROT_WRITE,
+                MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED)
+            return NULL;
+        arena = (char*)(((uintptr_t)p + HUGEPAGE_SIZE - 1) & ~(uintptr_t)(HUGEPAGE_SIZE - 1));
+        if (arena > p)
+            munmap(p, arena - p);
+        if (p + len > arena + size)
+            munmap(arena + size, p + len - (arena + size));
+        madvise(arena, size, MADV_HUGEPAGE);
+        return arena;
+    }
+    arena = mmap(NULL, size, PROT_READ|PROT_WRITE,
+            MAP_PRIVATE|MAP_ANONYMOUS, -1, 0);
+    return arena == MAP_FAILED ? NULL : arena;
+}
+
+// bound before the first touch, so every page comes from the node
+static char*
+_arena_create(struct netbuf* nb, size_t size, int flags) {
+    if (!(flags & (NETBUF_HUGEPAGE|NETBUF_PREFAULT)) && (flags >> 16) == 0) {
+        nb->arena_size = 0;
+        return malloc(size);
+    }
+    if (flags & NETBUF_HUGEPAGE)
+        size = (size + HUGEPAGE_SIZE - 1) & ~(size_t)(HUGEPAGE_SIZE - 1);
+    char* arena = _arena_map(size, flags & NETBUF_HUGEPAGE);
+    if (arena == NULL)
+        return NULL;
+    if ((flags >> 16) && _arena_bind(arena, size, (flags >> 16) - 1) == -1) {
+        munmap(arena, size);
+        return NULL;
+    }
+    if (flags & NETBUF_PREFAULT) {
+        if (madvise(arena, size, MADV_POPULATE_WRITE) == -1) {
+            size_t off;
+            for (off=0; off<size; off+=4096) {
+                arena[off] = 0;
+            }
+        }
+    }
+    nb->arena_size = size;
+    return arena;
 }
 
 struct netbuf* 
-netbuf_create(int max, int block_size) {
+netbuf_create_flags(int max, int block_size, int flags) {
     if (max == 0 || block_size == 0)
         return NULL;
-    struct netbuf* nb = malloc(sizeof(struct netbuf) + max * block_size);
+    if ((flags & NETBUF_MIRROR) && (flags & NETBUF_POOL))
+        return NULL;
+    if (flags & NETBUF_MIRROR)
+        return _create_mirror(max, block_size);
+    if (flags & NETBUF_POOL)
+        return _create_pool(max, block_size);
+    struct netbuf* nb = malloc(sizeof(struct netbuf));
+    nb->blocks = _arena_create(nb, (size_t)max * block_size, flags);
+    if (nb->blocks == NULL) {
+        free(nb);
+        return NULL;
+    }
     nb->max = max;
     nb->block_size = block_size;
+    nb->flags = 0;
+    nb->fd = -1;
+    nb->ring = NULL;
+    nb->heads = NULL;
+    nb->nclass = 0;
+    memset(&nb->stats, 0, sizeof(nb->stats));
+    nb->stats.inuse = nb->stats.highwater = (int64_t)max * block_size;
     return nb;
 }
 
+struct netbuf* 
+netbuf_create(int max, int block_size) {
+    return netbuf_create_flags(max, block_size, 0);
+}
+
 void 
 netbuf_free(struct netbuf* self) {
+    if (self == NULL)
+        return;
+    if (self->flags & NETBUF_MIRROR) {
+        munmap(self->ring, (size_t)self->max * 2 * self->block_size);
+        close(self->fd);
+        free(self->heads);
+    }
+    if (self->flags & NETBUF_POOL) {
+        int i;
+        for (i=0; i<self->max; ++i) {
+            free(self->heads[i].data);
+        }
+        for (i=0; i<self->nclass; ++i) {
+            while (self->class[i].free) {
+                void* data = self->class[i].free;
+                self->class[i].free = *(void**)data;
+                free(data);
+            }
+        }
+        free(self->heads);
+    }
+    if (self->arena_size)
+        munmap(self->blocks, self->arena_size);
+    else
+        free(self->blocks);
     free(self);
 }
@@ -3,18 +3,88 @@
 
 #include <stdint.h>
 
+// netbuf_create_flags flags
+// every block is a ring whose pages are mapped twice back to back, so
+// size bytes from any offset are contiguous and nothing is ever moved.
+// the block size is rounded up to whole pages
+#define NETBUF_MIRROR 1
+// blocks take a buffer from size-class free lists (4 KB doubling up to
+// the block size) only while they hold input, and grow a class at a time
+// for bigger messages. each class keeps at most 1 MB of idle buffers and
+// frees the rest, so a burst doesn't pin its peak. doesn't combine with
+// NETBUF_MIRROR
+#define NETBUF_POOL   2
+// the arena of plain blocks is mmap'd: on hugetlb pages if the system
+// has them reserved, else madvise(MADV_HUGEPAGE) for transparent ones.
+// the arena flags don't apply to NETBUF_MIRROR or NETBUF_POOL
+#define NETBUF_HUGEPAGE 4
+#define NETBUF_PREFAULT 8 // fault the whole arena in at create
+// arena pages bound to a NUMA node with mbind, n from 0
+#define NETBUF_NODE(n)  (((n) + 1) << 16)
+
+// input between base and woffset is live: base starts the message being
+// read, roffset is how far it has been read
 struct netbuf_block {
     int size;
     int roffset;
     int woffset;
+    int base;
+    char* data;
 };
 
 struct netbuf;
 
+struct netbuf_stats {
+    uint64_t nhit;      // buffers taken from a free list
+    uint64_t nmiss;     // buffers malloc'd
+    int64_t inuse;      // bytes held by blocks
+    int64_t highwater;  // most bytes ever held at once
+};
+
+static inline char*
+netbuf_rptr(struct netbuf_block* b) {
+    return b->data + b->roffset;
+}
+
+static inline char*
+netbuf_wptr(struct netbuf_block* b) {
+    return b->data + b->woffset;
+}
+
+// bytes that can be written at netbuf_wptr
+static inline int
+netbuf_space(struct netbuf_block* b) {
+    return b->base + b->size - b->woffset;
+}
+
+// whether n more bytes past roffset fit in the block with the message
+static inline int
+netbuf_fits(struct netbuf_block* b, int n) {
+    return b->roffset - b->base + n <= b->size;
+}
+
+// read the message again from its start
+static inline void
+netbuf_rewind(struct netbuf_block* b) {
+    b->roffset = b->base;
+}
+
 struct netbuf_block* netbuf_alloc_block(struct netbuf* self, int id);
 void netbuf_free_block(struct netbuf* self, struct netbuf_block* block);
+// the message up to roffset is done, returns the bytes moved to make room
+int netbuf_drop(struct netbuf* self, struct netbuf_block* block);
+// at least need bytes from base, a pooled block may move to a bigger
+// buffer. -1 if need is over the block size
+int netbuf_reserve(struct netbuf* self, struct netbuf_block* block, int need);
+// a pooled block without input gives its buffer back
+void netbuf_release(struct netbuf* self, struct netbuf_block* block);
+int netbuf_limit(struct netbuf* self); // most a block can grow to
+// safe from another thread, each counter is read whole
+void netbuf_stats(struct netbuf* self, struct netbuf_stats* st);
 
 struct netbuf* netbuf_create(int max, int block_size);
+// NULL if NETBUF_MIRROR can't be set up
+struct netbuf* netbuf_create_flags(int max, int block_size, int flags);
 void netbuf_free(struct netbuf* self);
 
 #endif
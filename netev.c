@@ -1,5 +1,8 @@
+#define _GNU_SOURCE
 #include "netev.h"
 #include "netbuf.h"
+#include "netev_uring.h"
+#include "timewheel.h"
 #include <assert.h>
 #include <stdlib.h>
 #include <unistd.h>
@@ -8,35 +11,224 @@
 #include <sys/epoll.h>
 #include <sys/socket.h>
 #include <sys/types.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <netinet/udp.h>
 #include <arpa/inet.h>
+#include <linux/errqueue.h>
 #include <string.h>
 #include <stdio.h>
 #include <signal.h>
+#include <stddef.h>
+#include <poll.h>
+#include <time.h>
 
 #define STATUS_INVALID     0
 #define STATUS_SUSPEND     1
 #define STATUS_CONNECTING  2
 #define STATUS_CONNECTED   3
+#define STATUS_LISTEN      4
+#define STATUS_DGRAM       5
 #define STATUS_OPENED      STATUS_SUSPEND
 
 #define LISTEN_BACKLOG 500
-#define LISTEN_SOCKET (void*)((intptr_t)~0)
+#define ACCEPT_BUDGET  64
+
+#define SOCKET_EDGE      1 // EPOLLET
+#define SOCKET_READABLE  2 // edge: kernel may still hold input
+#define SOCKET_WANTMORE  4 // last netev_read is waiting for more input
+#define SOCKET_WERROR    8 // output failed in netev_poll, next netev_send reports it
+#define SOCKET_ZEROCOPY  16 // SO_ZEROCOPY set
+#define SOCKET_NOZC      32 // SO_ZEROCOPY not supported
+#define SOCKET_RECV      64 // io_uring: multishot recv armed
+#define SOCKET_RSTOP     128 // io_uring: recv cancelled until the spill drains
+#define SOCKET_EOF       256 // io_uring: recv saw eof or an error
+#define SOCKET_GSO       512 // datagram: UDP_SEGMENT works
+#define SOCKET_WBLOCK    1024 // datagram: output waits for POLLOUT
+#define SOCKET_SEQPACKET 2048 // a read takes one message, short is not drained
+#define SOCKET_PARKED    4096 // read budget used up, on the ready list for the next round
+#define SOCKET_EVENT     8192 // classed: epoll reported input this round
+#define SOCKET_DEFERRED  16384 // classed: past its class weight, queued keeps its time
+#define SOCKET_PAUSED    32768 // output past the high watermark, input not taken
+#define SOCKET_PAUSEDMSG 65536 // paused inside a message, its clock restarts on resume
+
+#define WCHUNK_SIZE  8192
+#define WCHUNK_CACHE 1024
+#define FLUSH_IOV    64
+
+#define CLASS_LISTS  (NETEV_NCLASS * 2) // per class those deferred, then the rest
+
+// io_uring backend. user_data is the operation in the low bits, the socket
+// id and its generation above, a send carries its wchunk instead
+#define URING_ENTRIES 1024
+#define URING_NBUF    512
+#define URING_BUFSIZE 16384
+
+// the loop thread is the only writer of the stats, a relaxed store keeps 
+// each counter whole for netev_stats on another thread at no extra cost
+#ifdef NETEV_NO_STATS
+#define STATS 0
+#else
+#define STATS 1
+#endif
+#define STAT_ADD(self, field, n) do { \
+    if (STATS) \
+        __atomic_store_n(&(self)->stats.field, (self)->stats.field + (n), __ATOMIC_RELAXED); \
+} while (0)
+#define STAT_INC(self, field) STAT_ADD(self, field, 1)
+
+#define UOP_ACCEPT  1
+#define UOP_RECV    2
+#define UOP_CONNECT 3
+#define UOP_SEND    4
+#define UOP_CANCEL  5
+#define UOP_CLOSE   6
+#define UOP_POLL    7 // datagram socket: multishot POLLIN, POLLOUT is a UOP_CONNECT
+#define UOP_MASK    7
+
+// datagram sockets
+#define UDP_BATCH    64     // datagrams per recvmmsg and sendmmsg
+#define UDP_ROUNDS   4      // recvmmsg calls per wakeup
+#define UDP_SLOT     65536  // the largest datagram, or a GRO train
+#define UDP_MAX      65507  // payload of a datagram, and of a GSO message
+#define UDP_GSO_SEGS 64     // segments of a GSO message
+#define UDP_IOV      256
+
+struct netev_buf {
+    int ref;
+    int size;
+    char data[0];
+};
+
+struct wchunk {
+    struct wchunk* next;
+    struct socket* owner; // io_uring: NULL once the socket closed under a send
+    int sending;          // io_uring: a send SQE points into it
+    int roffset;
+    int woffset;
+    struct netev_buf* buf; // shared payload, no data of its own then
+    char data[WCHUNK_SIZE];
+};
+
+#define WCHUNK_HEAD offsetof(struct wchunk, data)
+
+static inline char*
+_wchunk_data(struct wchunk* c) {
+    return c->buf ? c->buf->data : c->data;
+}
+
+// MSG_ZEROCOPY sends not yet completed, indexed by the kernel's 
+// per socket counter starting at seq
+struct zcpend {
+    uint32_t seq;
+    int head;
+    int count;
+    int cap;
+    struct {
+        const void* buf;
+        int done;
+    } ent[0];
+};
+
+// a message larger than the block: what of it was in the block stays
+// there, the rest goes to a pooled spill with room for that part in front
+struct bigmsg {
+    struct bigmsg* next; // free list
+    int cap;
+    int room;   // the block size, head room in data
+    int size;   // the message
+    int head;   // its bytes in the block, from where it starts
+    int have;   // its bytes in the spill
+    int done;
+    char data[0];
+};
+
+#define BIGMSG_MIN   (256*1024)
+#define BIGMSG_CACHE 8
+
+// recvmmsg lands in UDP_BATCH slots of UDP_SLOT bytes, taken with the 
+// first datagram socket. only the pages datagrams touch become resident
+struct dgring {
+    struct mmsghdr msg[UDP_BATCH];
+    struct iovec iov[UDP_BATCH];
+    struct sockaddr_in from[UDP_BATCH];
+    char ctrl[UDP_BATCH][CMSG_SPACE(sizeof(int))]; // UDP_GRO segment size
+    char* data;
+};
+
+// a datagram socket's output is records packed in one growing buffer, 
+// each a dgram_rec with the payload after it, 8 byte aligned
+struct dgram_rec {
+    uint32_t addr;
+    uint16_t port;
+    uint16_t size;
+};
+
+struct link {
+    struct link* prev;
+    struct link* next;
+};
+
+#define LINK_ENTRY(l, type, member) \
+    ((type*)((char*)(l) - offsetof(type, member)))
 
 struct socket {
     int fd;
     int status;
+    int flags;
+    uint32_t events; // registered with epoll
     struct netbuf_block* rbuf_b;
 
+    struct wchunk* whead; // output queue
+    struct wchunk* wtail;
+    int wsize;
+
+    struct zcpend* zc;
+    uint32_t zc_seq; // next zerocopy send
+
+    int frame;       // NETEV_FRAME_*, rcb is a netev_msgcb then
+    uint32_t gen;    // io_uring: tags the slot's operations
+    int nsend;       // io_uring: send SQEs in flight
+    char* spill;     // io_uring: input that did not fit the block
+    int spill_size;
+    int spill_cap;
+    struct bigmsg* big; // up to netev_dropread
+    uint32_t round;     // the netev_poll round the budget counts are for
+    int round_frames;   // messages read in it
+    int round_bytes;
+    int prio;           // NETEV_PRIO_*
+    uint64_t queued;    // ns, became ready to dispatch
+    char* dgout;        // datagram socket: queued dgram_recs
+    int dgout_head;
+    int dgout_size;
+    int dgout_cap;
+    int dgout_count;
+
     netev_readcb rcb;
     netev_writecb wcb;
     void* data;
+
+    uint64_t active;  // last input
+    uint64_t partial; // a message has been incomplete since
+
+    struct link ready;
+    struct link idle;       // by last input
+    struct link incomplete; // by start of the incomplete message
+    struct link writable; // io_uring: has a write callback
+    struct link flush;    // io_uring: output to submit, datagrams to send
 };
 
 struct netev {
     int epoll_fd;
+    struct uring* uring; // NETEV_URING, no epoll_fd then
 
-    int listen_fd;
-    netev_listencb listen_cb;
+    int accept_budget;
+    int reserve_fd; // given up to accept one connection when out of fds
+    int spin_us;   // zero timeout polls before a blocking one
+    int busy_poll; // SO_BUSY_POLL of new sockets
 
     int max;
     struct epoll_event* events;
@@ -45,32 +237,135 @@ struct netev {
     struct socket* free_socket;
 
     struct netbuf* rbuf;
+    struct link ready; // edge sockets not yet drained, io_uring: input to dispatch
+    struct link writable;
+    struct link flush;
+
+    struct wchunk* free_wchunk;
+    int nfree_wchunk;
+    int send_limit;
+    int high_watermark; // 0 off
+    int low_watermark;
+    netev_watermarkcb watermark_cb;
+    struct wchunk* orphan; // io_uring: sends of closed sockets still in flight
+    int nclosing;
 
+    int read_limit;
+    int budget_frames; // per socket per round, 0 no limit
+    int budget_bytes;
+    uint32_t round;    // _poll calls
+    int nclassed;      // sockets out of NETEV_PRIO_NORMAL
+    int weighted;
+    int weights[NETEV_NCLASS];
+    struct bigmsg* free_big;
+    int nfree_big;
+
+    struct dgring* dgring;
+
+    int zc_threshold;
+    netev_zerocopycb zc_cb;
+
+    struct timewheel* timer;
+    uint64_t now; // monotonic ms, cached per netev_poll
+
+    // the lists are in deadline order, one timeout each
+    struct link idle;
+    struct link incomplete;
+    int idle_timeout;
+    int msg_timeout;
+    netev_closecb close_cb;
+
+    int flags;
     int error;
+    int timing; // callbacks timed into hist_callback
+    struct netev_stats stats;
 };
 
+static inline void
+_link_init(struct link* l) {
+    l->prev = l;
+    l->next = l;
+}
+
 static inline int
-_add_event(struct netev* self, struct socket* s, int events) {
-    if (events == 0)
-        return -1;
+_link_empty(struct link* l) {
+    return l->next == l;
+}
+
+static inline void
+_link_remove(struct link* l) {
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->prev = l;
+    l->next = l;
+}
+
+static inline void
+_link_push(struct link* head, struct link* l) {
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+// move all of src to the empty list dst
+static inline void
+_link_move(struct link* dst, struct link* src) {
+    if (_link_empty(src)) {
+        _link_init(dst);
+        return;
+    }
+    dst->next = src->next;
+    dst->prev = src->prev;
+    dst->next->prev = dst;
+    dst->prev->next = dst;
+    _link_init(src);
+}
 
-    int op = (s->rcb == NULL && s->wcb == NULL) ? 
-        EPOLL_CTL_ADD : EPOLL_CTL_MOD;
+static inline int
+_ctl_event(struct netev* self, struct socket* s, uint32_t events) {
+    if (events == s->events)
+        return 0;
+    int op;
+    if (s->events == 0)
+        op = EPOLL_CTL_ADD;
+    else if (events == 0)
+        op = EPOLL_CTL_DEL;
+    else
+        op = EPOLL_CTL_MOD;
     
     struct epoll_event ev;
     ev.events = events;
     ev.data.ptr = s;
-    return epoll_ctl(self->epoll_fd, op, s->fd, &ev);
+    if (epoll_ctl(self->epoll_fd, op, s->fd, &ev) == -1)
+        return -1;
+    s->events = events;
+    return 0;
+}
+
+static inline int
+_add_event(struct netev* self, struct socket* s, int events) {
+    if (events == 0)
+        return -1;
+    return _ctl_event(self, s, events);
 }
 
 static inline int
 _del_event(struct netev* self, struct socket* s) {
-    if (s->rcb == NULL && s->wcb == NULL)
+    if (s->events == 0)
         return -1;
-    struct epoll_event ev;
-    ev.events = 0;
-    ev.data.ptr = s;
-    return epoll_ctl(self->epoll_fd, EPOLL_CTL_DEL, s->fd, &ev);
+    return _ctl_event(self, s, 0);
+}
+
+// EPOLLOUT is wanted by a write callback, or while output is queued
+static inline int
+_update_write_event(struct netev* self, struct socket* s) {
+    uint32_t events = s->events & ~EPOLLOUT;
+    if (s->wcb || s->wsize > 0)
+        events |= EPOLLOUT;
+    if ((events & ~EPOLLET) == 0)
+        events = 0;
+    return _ctl_event(self, s, events);
 }
 
 static inline int
@@ -95,6 +390,84 @@ _set_reuseaddr(int fd) {
     return setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
 }
 
+static inline int
+_set_reuseport(int fd) {
+    int reuse = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &reuse, sizeof(reuse));
+}
+
+static inline uint64_t
+_monotonic() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+static inline uint64_t
+_monotonic_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+// a wait that may have blocked, its time goes to block_ns
+static inline void
+_blocked(struct netev* self, uint64_t since) {
+    STAT_INC(self, nblock);
+    STAT_ADD(self, block_ns, _monotonic_ns() - since);
+}
+
+// floor(log2(v)), the last bucket takes the rest
+static inline int
+_hist_bucket(uint64_t v) {
+    int b = v ? 63 - __builtin_clzll(v) : 0;
+    return b < NETEV_HIST ? b : NETEV_HIST - 1;
+}
+
+// a callback of the application starts, 0 if not timed
+static inline uint64_t
+_cb_begin(struct netev* self) {
+    return STATS && self->timing ? _monotonic_ns() : 0;
+}
+
+static inline void
+_cb_end(struct netev* self, uint64_t start) {
+    if (start > 0)
+        STAT_INC(self, hist_callback[_hist_bucket(_monotonic_ns() - start)]);
+}
+
+// a syscall's result (or an io_uring completion's, err then -res)
+static inline void
+_stat_read(struct netev* self, int nbyte, int err) {
+    STAT_INC(self, nread);
+    if (nbyte > 0)
+        STAT_ADD(self, nread_bytes, nbyte);
+    else if (nbyte < 0 && (err == EAGAIN || err == EWOULDBLOCK))
+        STAT_INC(self, nread_again);
+}
+
+static inline void
+_stat_write(struct netev* self, int nbyte, int err) {
+    STAT_INC(self, nwrite);
+    if (nbyte > 0)
+        STAT_ADD(self, nwrite_bytes, nbyte);
+    else if (nbyte < 0 && (err == EAGAIN || err == EWOULDBLOCK))
+        STAT_INC(self, nwrite_again);
+}
+
+// the kernel polls the device queue for the socket before it sleeps,
+// quietly not where the value needs CAP_NET_ADMIN
+static inline void
+_set_busy_poll(struct netev* self, int fd) {
+    if (self->busy_poll <= 0)
+        return;
+    setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &self->busy_poll, sizeof(self->busy_poll));
+#ifdef SO_PREFER_BUSY_POLL
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &one, sizeof(one));
+#endif
+}
+
 static struct socket*
 _alloc_sockets(int max) {
     int i;
@@ -102,10 +475,38 @@ _alloc_sockets(int max) {
     for (i=0; i<max; ++i) {
         s[i].fd = i+1;
         s[i].status = STATUS_INVALID;
+        s[i].flags = 0;
+        s[i].events = 0;
         s[i].rbuf_b = NULL;
+        s[i].whead = NULL;
+        s[i].wtail = NULL;
+        s[i].wsize = 0;
+        s[i].zc = NULL;
+        s[i].zc_seq = 0;
+        s[i].frame = 0;
+        s[i].gen = 0;
+        s[i].nsend = 0;
+        s[i].spill = NULL;
+        s[i].spill_size = 0;
+        s[i].spill_cap = 0;
+        s[i].big = NULL;
+        s[i].prio = NETEV_PRIO_NORMAL;
+        s[i].queued = 0;
+        s[i].dgout = NULL;
+        s[i].dgout_head = 0;
+        s[i].dgout_size = 0;
+        s[i].dgout_cap = 0;
+        s[i].dgout_count = 0;
         s[i].rcb = NULL;
         s[i].wcb = NULL;
         s[i].data = NULL;
+        s[i].active = 0;
+        s[i].partial = 0;
+        _link_init(&s[i].ready);
+        _link_init(&s[i].idle);
+        _link_init(&s[i].incomplete);
+        _link_init(&s[i].writable);
+        _link_init(&s[i].flush);
     }
     s[max-1].fd = -1;
     return s;
@@ -117,6 +518,9 @@ _create_socket(struct netev* self, int fd) {
         return NULL;
 
     struct socket* s = self->free_socket;
+    struct netbuf_block* rbuf_b = netbuf_alloc_block(self->rbuf, s-self->sockets);
+    if (rbuf_b == NULL)
+        return NULL;
     if (s->fd >= 0)
         self->free_socket = &self->sockets[s->fd];
     else
@@ -124,29 +528,338 @@ _create_socket(struct netev* self, int fd) {
     
     s->fd = fd; 
     s->status = STATUS_SUSPEND;
-    s->rbuf_b = netbuf_alloc_block(self->rbuf, s-self->sockets);
+    s->flags = 0;
+    s->gen++;
+    s->rbuf_b = rbuf_b;
+    STAT_INC(self, nsocket);
+    return s;
+}
+
+// input arrived, to the back of the idle list. a paused socket is off
+// it until _resume
+static inline void
+_touch(struct netev* self, struct socket* s) {
+    if (s->flags & SOCKET_PAUSED)
+        return;
+    s->active = self->now;
+    _link_remove(&s->idle);
+    _link_push(&self->idle, &s->idle);
+}
+
+// netev_read is waiting for more of a message, the clock starts once.
+// called with the block rewound to the message: an empty one means no
+// message has begun, a handler reading until NULL is only idle
+static inline void
+_partial_begin(struct netev* self, struct socket* s) {
+    if (s->big == NULL && s->rbuf_b->woffset == s->rbuf_b->roffset)
+        return;
+    if (s->flags & SOCKET_PAUSED) {
+        s->flags |= SOCKET_PAUSEDMSG;
+        return;
+    }
+    if (_link_empty(&s->incomplete)) {
+        s->partial = self->now;
+        _link_push(&self->incomplete, &s->incomplete);
+    }
+}
+
+static inline struct wchunk*
+_alloc_wchunk(struct netev* self) {
+    struct wchunk* c = self->free_wchunk;
+    if (c) {
+        self->free_wchunk = c->next;
+        self->nfree_wchunk--;
+    } else {
+        c = malloc(sizeof(struct wchunk));
+    }
+    c->next = NULL;
+    c->owner = NULL;
+    c->sending = 0;
+    c->roffset = 0;
+    c->woffset = 0;
+    c->buf = NULL;
+    return c;
+}
+
+static inline void
+_free_wchunk(struct netev* self, struct wchunk* c) {
+    if (c->buf) {
+        netev_buf_release(c->buf);
+        free(c);
+        return;
+    }
+    if (self->nfree_wchunk >= WCHUNK_CACHE) {
+        free(c);
+        return;
+    }
+    c->next = self->free_wchunk;
+    self->free_wchunk = c;
+    self->nfree_wchunk++;
+}
+
+static inline void
+_clear_output(struct netev* self, struct socket* s) {
+    struct wchunk* c = s->whead;
+    while (c) {
+        struct wchunk* next = c->next;
+        if (c->sending) {
+            // the kernel still reads it, freed by its completion
+            c->owner = NULL;
+            c->next = self->orphan;
+            self->orphan = c;
+        } else {
+            _free_wchunk(self, c);
+        }
+        c = next;
+    }
+    s->whead = NULL;
+    s->wtail = NULL;
+    s->wsize = 0;
+    s->nsend = 0;
+}
+
+static inline struct bigmsg*
+_big_alloc(struct netev* self, int need) {
+    struct bigmsg** p = &self->free_big;
+    while (*p && (*p)->cap < need)
+        p = &(*p)->next;
+    struct bigmsg* b = *p;
+    if (b) {
+        *p = b->next;
+        self->nfree_big--;
+    } else {
+        int cap = BIGMSG_MIN;
+        while (cap < need)
+            cap *= 2;
+        b = malloc(sizeof(struct bigmsg) + cap);
+        b->cap = cap;
+    }
+    b->next = NULL;
+    return b;
+}
+
+static inline void
+_big_free(struct netev* self, struct socket* s) {
+    struct bigmsg* b = s->big;
+    if (b == NULL)
+        return;
+    s->big = NULL;
+    if (self->nfree_big >= BIGMSG_CACHE) {
+        free(b);
+        return;
+    }
+    b->next = self->free_big;
+    self->free_big = b;
+    self->nfree_big++;
+}
+
+static inline uint64_t
+_uring_ud(struct netev* self, struct socket* s, int op) {
+    return (uint64_t)s->gen << 32 | (uint64_t)(s - self->sockets) << 3 | op;
+}
+
+// the socket an operation was queued for, NULL if it closed since
+static inline struct socket*
+_uring_socket(struct netev* self, uint64_t ud) {
+    struct socket* s = &self->sockets[(uint32_t)ud >> 3];
+    if (s->status == STATUS_INVALID || s->gen != (uint32_t)(ud >> 32))
+        return NULL;
     return s;
 }
 
+static inline struct io_uring_sqe*
+_uring_prep(struct netev* self, int opcode, int fd, uint64_t ud) {
+    struct io_uring_sqe* sqe = uring_sqe(self->uring);
+    if (sqe == NULL)
+        return NULL;
+    sqe->opcode = opcode;
+    sqe->fd = fd;
+    sqe->user_data = ud;
+    return sqe;
+}
+
+static inline int
+_uring_recv(struct netev* self, struct socket* s) {
+    if (s->flags & (SOCKET_RECV|SOCKET_RSTOP|SOCKET_EOF|SOCKET_PAUSED))
+        return 0;
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_RECV, s->fd, 
+            _uring_ud(self, s, UOP_RECV));
+    if (sqe == NULL)
+        return -1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = 0;
+    s->flags |= SOCKET_RECV;
+    return 0;
+}
+
+static inline int
+_uring_accept(struct netev* self, struct socket* ls) {
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_ACCEPT, ls->fd, 
+            _uring_ud(self, ls, UOP_ACCEPT));
+    if (sqe == NULL)
+        return -1;
+    sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+    sqe->accept_flags = SOCK_NONBLOCK|SOCK_CLOEXEC;
+    return 0;
+}
+
+// a one-shot POLLIN on the listen socket: io_uring takes the fd before
+// the connection, out of fds a rearmed accept fails again at once, the
+// poll waits for a connection without one
+static inline int
+_uring_accept_poll(struct netev* self, struct socket* ls) {
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_POLL_ADD, ls->fd, 
+            _uring_ud(self, ls, UOP_POLL));
+    if (sqe == NULL)
+        return -1;
+    sqe->poll32_events = POLLIN;
+    return 0;
+}
+
+static inline void
+_uring_cancel(struct netev* self, uint64_t ud) {
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_ASYNC_CANCEL, -1, UOP_CANCEL);
+    if (sqe) {
+        sqe->addr = ud;
+    }
+}
+
+// cancel whatever is queued on the fd, then close it. hard linked so the
+// close runs whatever the cancel found, and the fd can't be reused before
+static inline void
+_uring_close(struct netev* self, int fd) {
+    if (uring_space(self->uring) < 2)
+        uring_enter(self->uring, 0, 0);
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_ASYNC_CANCEL, fd, UOP_CANCEL);
+    if (sqe == NULL) {
+        close(fd);
+        return;
+    }
+    sqe->cancel_flags = IORING_ASYNC_CANCEL_FD | IORING_ASYNC_CANCEL_ALL;
+    sqe->flags = IOSQE_IO_HARDLINK;
+    sqe = _uring_prep(self, IORING_OP_CLOSE, fd, UOP_CLOSE);
+    if (sqe == NULL) {
+        close(fd);
+        return;
+    }
+    self->nclosing++;
+}
+
+// the buffer is the application's again
+static inline void
+_zerocopy_done(struct netev* self, struct socket* s, int i) {
+    struct zcpend* zc = s->zc;
+    const void* buf = zc->ent[i].buf;
+    zc->ent[i].done = 1;
+    while (zc->count > 0 && zc->ent[zc->head].done) {
+        zc->head = (zc->head + 1) % zc->cap;
+        zc->seq++;
+        zc->count--;
+    }
+    STAT_INC(self, nzerocopy_done);
+    if (self->zc_cb) {
+        uint64_t t = _cb_begin(self);
+        self->zc_cb(s->fd, s - self->sockets, s->data, buf);
+        _cb_end(self, t);
+    }
+}
+
+// the socket is closed, the kernel won't report any more: hand everything back
+static inline void
+_release_zerocopy(struct netev* self, struct zcpend* zc, int fd, int id, void* data) {
+    int i;
+    for (i=0; i<zc->count; ++i) {
+        int k = (zc->head + i) % zc->cap;
+        if (zc->ent[k].done)
+            continue;
+        STAT_INC(self, nzerocopy_done);
+        if (self->zc_cb) {
+            uint64_t t = _cb_begin(self);
+            self->zc_cb(fd, id, data, zc->ent[k].buf);
+            _cb_end(self, t);
+        }
+    }
+    free(zc);
+}
+
 static inline void
 _close_socket(struct netev* self, struct socket* s) {
     if (s->status == STATUS_INVALID)
         return;
 
-    _del_event(self, s);
-    close(s->fd);
+    struct zcpend* zc = s->zc;
+    int fd = s->fd;
+    void* data = s->data;
+    s->zc = NULL;
+    s->zc_seq = 0;
+
+    if (self->uring) {
+        _uring_close(self, s->fd);
+        _link_remove(&s->writable);
+        free(s->spill);
+        s->spill = NULL;
+        s->spill_size = 0;
+        s->spill_cap = 0;
+    } else {
+        _del_event(self, s);
+        close(s->fd);
+    }
+    _link_remove(&s->ready);
+    _link_remove(&s->idle);
+    _link_remove(&s->incomplete);
+    _link_remove(&s->flush);
+    _clear_output(self, s);
+    _big_free(self, s);
+    if (s->dgout) {
+        free(s->dgout);
+        s->dgout = NULL;
+        s->dgout_head = 0;
+        s->dgout_size = 0;
+        s->dgout_cap = 0;
+        s->dgout_count = 0;
+    }
     
     s->fd = self->free_socket ? self->free_socket - self->sockets : -1;
     s->status = STATUS_INVALID;
+    STAT_ADD(self, nsocket, -1);
+    s->flags = 0;
+    s->frame = 0;
+    s->events = 0;
+    if (s->prio != NETEV_PRIO_NORMAL) {
+        s->prio = NETEV_PRIO_NORMAL;
+        self->nclassed--;
+    }
     
-    netbuf_free_block(self->rbuf, s->rbuf_b);
-    s->rbuf_b = NULL;
+    if (s->rbuf_b) {
+        netbuf_free_block(self->rbuf, s->rbuf_b);
+        s->rbuf_b = NULL;
+    }
     
     s->rcb = NULL;
     s->wcb = NULL;
     s->data = NULL;
 
     self->free_socket = s;
+    if (zc) {
+        _release_zerocopy(self, zc, fd, s - self->sockets, data);
+    }
+}
+
+// closed by netev itself, outside any call of the application
+static inline void
+_close_report(struct netev* self, struct socket* s, int error) {
+    int fd = s->fd;
+    int id = s - self->sockets;
+    void* data = s->data;
+    _close_socket(self, s);
+    STAT_INC(self, nclose[error]);
+    if (self->close_cb) {
+        self->error = error;
+        uint64_t t = _cb_begin(self);
+        self->close_cb(fd, id, data, error);
+        _cb_end(self, t);
+    }
 }
 
 static inline struct socket*
@@ -158,30 +871,155 @@ _get_socket(struct netev* self, int id) {
 void 
 netev_close_socket(struct netev* self, int id) {
     struct socket* s = _get_socket(self, id);
-    if (s) {
+    if (s && s->status != STATUS_INVALID) {
+        STAT_INC(self, nclose[NETEV_OK]);
         _close_socket(self, s);
     }
 }
 
+// input taken and not yet read
+static inline int
+_buffered(struct socket* s) {
+    return s->rbuf_b->woffset - s->rbuf_b->roffset + s->spill_size;
+}
+
+static inline void
+_watermark(struct netev* self, struct socket* s, int high) {
+    if (self->watermark_cb) {
+        uint64_t t = _cb_begin(self);
+        self->watermark_cb(s->fd, s - self->sockets, s->data, high);
+        _cb_end(self, t);
+    }
+}
+
+// output reached the high watermark: stop taking input, so the peer's
+// window fills and TCP holds it back. the timeouts stop too, the peer
+// isn't idle or slow, it is held off
+static inline void
+_pause(struct netev* self, struct socket* s) {
+    s->flags |= SOCKET_PAUSED;
+    _link_remove(&s->ready);
+    _link_remove(&s->idle);
+    if (!_link_empty(&s->incomplete)) {
+        _link_remove(&s->incomplete);
+        s->flags |= SOCKET_PAUSEDMSG;
+    }
+    if (self->uring) {
+        if (s->flags & SOCKET_RECV)
+            _uring_cancel(self, _uring_ud(self, s, UOP_RECV));
+    } else if (s->events & EPOLLIN) {
+        _ctl_event(self, s, s->events & ~EPOLLIN);
+    }
+    STAT_INC(self, npaused);
+    _watermark(self, s, 1);
+}
+
+// drained to the low watermark: input again, what is buffered by the 
+// next round
+static inline void
+_resume(struct netev* self, struct socket* s) {
+    s->flags &= ~SOCKET_PAUSED;
+    if (s->status == STATUS_CONNECTED) {
+        _touch(self, s);
+        if (s->flags & SOCKET_PAUSEDMSG) {
+            s->partial = self->now;
+            _link_push(&self->incomplete, &s->incomplete);
+        }
+    }
+    s->flags &= ~SOCKET_PAUSEDMSG;
+    if (s->rcb && s->status == STATUS_CONNECTED) {
+        if (self->uring) {
+            _uring_recv(self, s);
+        } else {
+            uint32_t events = s->events | EPOLLIN;
+            if (s->flags & SOCKET_EDGE)
+                events |= EPOLLET;
+            _ctl_event(self, s, events);
+        }
+        if (_buffered(s) > 0 || (s->flags & (SOCKET_READABLE|SOCKET_EOF))) {
+            if (_link_empty(&s->ready))
+                _link_push(&self->ready, &s->ready);
+        }
+    }
+    _watermark(self, s, 0);
+}
+
+// after output is queued
+static inline void
+_check_high(struct netev* self, struct socket* s) {
+    if (self->high_watermark > 0 && s->wsize >= self->high_watermark &&
+        !(s->flags & SOCKET_PAUSED) && s->status == STATUS_CONNECTED)
+        _pause(self, s);
+}
+
+// after output went out or was dropped
+static inline void
+_check_low(struct netev* self, struct socket* s) {
+    if ((s->flags & SOCKET_PAUSED) && s->wsize <= self->low_watermark)
+        _resume(self, s);
+}
+
+// completions are edge like: rcb is called when input arrives, and again
+// while it leaves input it has not asked for
+static int
+_uring_add_event(struct netev* self, struct socket* s, int mask, 
+        netev_readcb rcb, netev_writecb wcb, void* data) {
+    if (!((mask & NETEV_READ) && rcb) && 
+        !((mask & NETEV_WRITE) && wcb) && s->wsize == 0)
+        return -1;
+    s->rcb = (mask & NETEV_READ)  ? rcb : NULL;
+    s->wcb = (mask & NETEV_WRITE) ? wcb : NULL;
+    s->data = data;
+    if (s->rcb) {
+        if (s->status == STATUS_CONNECTED &&
+            _uring_recv(self, s) == -1)
+            return -1;
+        if (_buffered(s) > 0 && _link_empty(&s->ready) && 
+            !(s->flags & SOCKET_PAUSED))
+            _link_push(&self->ready, &s->ready);
+    } else {
+        _link_remove(&s->ready);
+    }
+    _link_remove(&s->writable);
+    if (s->wcb) {
+        _link_push(&self->writable, &s->writable);
+    }
+    return 0;
+}
+
 int
 netev_add_event(struct netev* self, int id, int mask, netev_readcb rcb, netev_writecb wcb, void* data) {
     struct socket* s = _get_socket(self, id);
-    if (s == NULL)
+    if (s == NULL || s->status == STATUS_LISTEN || s->status == STATUS_DGRAM)
         return -1;
+    s->frame = 0;
+    if (self->uring)
+        return _uring_add_event(self, s, mask, rcb, wcb, data);
     uint32_t events = 0;
-    if ((mask & NETEV_READ) && rcb) {
+    if ((mask & NETEV_READ) && rcb && !(s->flags & SOCKET_PAUSED)) {
         events |= EPOLLIN;
     }
-    if ((mask & NETEV_WRITE) && wcb) {
+    if (((mask & NETEV_WRITE) && wcb) || s->wsize > 0) {
         events |= EPOLLOUT;
     }
     if (events == 0)
         return -1;
+    int edge = (mask & NETEV_EDGE) || (self->flags & NETEV_EDGE);
+    if (edge) {
+        events |= EPOLLET;
+    }
     int r = _add_event(self, s, events);
     if (r != -1) { 
         s->rcb = (mask & NETEV_READ)  ? rcb : NULL;
         s->wcb = (mask & NETEV_WRITE) ? wcb : NULL;
         s->data = data;
+        if (edge) {
+            // epoll reports current readiness once on ADD/MOD
+            s->flags |= SOCKET_EDGE;
+        } else {
+            s->flags &= ~(SOCKET_EDGE|SOCKET_READABLE);
+            _link_remove(&s->ready);
+        }
     }
     return r;
 }
@@ -191,42 +1029,130 @@ netev_del_event(struct netev* self, int id) {
     struct socket* s = _get_socket(self, id);
     if (s == NULL)
         return -1;
-    int r = _del_event(self, s);
+    if (self->uring) {
+        // queued output keeps going out
+        if (s->flags & SOCKET_RECV) {
+            _uring_cancel(self, _uring_ud(self, s, UOP_RECV));
+        }
+        s->rcb = NULL;
+        s->wcb = NULL;
+        s->frame = 0;
+        _link_remove(&s->ready);
+        _link_remove(&s->writable);
+        return 0;
+    }
+    int r = s->wsize > 0 ? 
+        _ctl_event(self, s, EPOLLOUT) : // keep flushing
+        _del_event(self, s);
     if (r == 0) {
         s->rcb = NULL;
         s->wcb = NULL;
+        s->frame = 0;
+        s->flags &= ~(SOCKET_EDGE|SOCKET_READABLE);
+        _link_remove(&s->ready);
     }
     return r;
 }
 
 struct netev*
-netev_create(int max, int block_size) {
+netev_create_flags(int max, int block_size, int flags) {
     signal(SIGHUP, SIG_IGN);
     signal(SIGPIPE, SIG_IGN);
 
     if (max == 0 || block_size == 0)
         return NULL;
 
-    int epoll_fd = epoll_create(max+1);
-    if (epoll_fd == -1) {
-        return NULL;
+    // NETEV_BACKEND=uring switches unmodified programs over, falling back
+    // to epoll where io_uring is missing
+    struct uring* uring = NULL;
+    const char* backend = getenv("NETEV_BACKEND");
+    if ((flags & NETEV_URING) || 
+        (backend && strcmp(backend, "uring") == 0)) {
+        uring = uring_create(URING_ENTRIES, URING_NBUF, URING_BUFSIZE);
+        if (uring == NULL && (flags & NETEV_URING))
+            return NULL;
     }
-    if (_set_closeonexec(epoll_fd) == -1) {
+    struct netbuf* rbuf = netbuf_create_flags(max, block_size, 
+            ((flags & NETEV_MIRROR) ? NETBUF_MIRROR : 0) |
+            ((flags & NETEV_POOL) ? NETBUF_POOL : 0) |
+            ((flags & NETEV_HUGEPAGE) ? NETBUF_HUGEPAGE : 0) |
+            ((flags & NETEV_PREFAULT) ? NETBUF_PREFAULT : 0) |
+            ((flags >> 16) ? NETBUF_NODE((flags >> 16) - 1) : 0));
+    if (rbuf == NULL) {
+        uring_free(uring);
         return NULL;
     }
-    struct netev* ne = malloc(sizeof(struct netev));
-    ne->epoll_fd = epoll_fd;
-    ne->listen_fd = -1;
-    ne->listen_cb = NULL;
-    ne->max = max;
-    ne->events = malloc(max * sizeof(struct epoll_event));
-    ne->sockets = _alloc_sockets(max);
+    int epoll_fd = -1;
+    if (uring) {
+        flags |= NETEV_URING;
+    } else {
+        flags &= ~NETEV_URING;
+        epoll_fd = epoll_create(max+1);
+        if (epoll_fd == -1) {
+            netbuf_free(rbuf);
+            return NULL;
+        }
+        if (_set_closeonexec(epoll_fd) == -1) {
+            netbuf_free(rbuf);
+            return NULL;
+        }
+    }
+    struct netev* ne = malloc(sizeof(struct netev));
+    ne->epoll_fd = epoll_fd;
+    ne->uring = uring;
+    ne->accept_budget = ACCEPT_BUDGET;
+    ne->reserve_fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+    ne->spin_us = 0;
+    ne->busy_poll = 0;
+    ne->max = max;
+    ne->events = uring ? NULL : malloc(max * sizeof(struct epoll_event));
+    ne->sockets = _alloc_sockets(max);
     ne->free_socket = &ne->sockets[0];
-    ne->rbuf = netbuf_create(max, block_size);
+    ne->rbuf = rbuf;
+    _link_init(&ne->ready);
+    _link_init(&ne->writable);
+    _link_init(&ne->flush);
+    ne->free_wchunk = NULL;
+    ne->nfree_wchunk = 0;
+    ne->send_limit = 0;
+    ne->high_watermark = 0;
+    ne->low_watermark = 0;
+    ne->watermark_cb = NULL;
+    ne->orphan = NULL;
+    ne->nclosing = 0;
+    ne->zc_threshold = 0;
+    ne->zc_cb = NULL;
+    ne->now = _monotonic();
+    ne->timer = timewheel_create(ne->now);
+    _link_init(&ne->idle);
+    _link_init(&ne->incomplete);
+    ne->idle_timeout = 0;
+    ne->msg_timeout = 0;
+    ne->close_cb = NULL;
+    ne->read_limit = 0;
+    ne->budget_frames = 0;
+    ne->budget_bytes = 0;
+    ne->round = 0;
+    ne->nclassed = 0;
+    ne->weighted = 0;
+    memset(ne->weights, 0, sizeof(ne->weights));
+    ne->free_big = NULL;
+    ne->nfree_big = 0;
+    ne->dgring = NULL;
+    ne->flags = flags;
     ne->error = NETEV_OK;
+    ne->timing = 0;
+    memset(&ne->stats, 0, sizeof(ne->stats));
     return ne;
 }
 
+struct netev*
+netev_create(int max, int block_size) {
+    return netev_create_flags(max, block_size, 0);
+}
+
+static void _uring_shutdown(struct netev* self);
+
 void
 netev_free(struct netev* self) {
     if (self == NULL)
@@ -239,17 +1165,305 @@ netev_free(struct netev* self) {
             _close_socket(self, s);
         }
     }
+    if (self->uring) {
+        _uring_shutdown(self);
+    }
     free(self->sockets);
     free(self->events);
+    if (self->dgring) {
+        free(self->dgring->data);
+        free(self->dgring);
+    }
+    while (self->free_big) {
+        struct bigmsg* b = self->free_big;
+        self->free_big = b->next;
+        free(b);
+    }
+    while (self->free_wchunk) {
+        struct wchunk* c = self->free_wchunk;
+        self->free_wchunk = c->next;
+        free(c);
+    }
     netbuf_free(self->rbuf);
+    timewheel_free(self->timer);
 
-    if (self->listen_fd >= 0) {
-        close(self->listen_fd);
-    }
-    close(self->epoll_fd);
+    if (self->epoll_fd >= 0)
+        close(self->epoll_fd);
+    if (self->reserve_fd >= 0)
+        close(self->reserve_fd);
     free(self);
 }
 
+// a pooled block takes a buffer when input comes, sized for hint bytes
+static inline void
+_rbuf_acquire(struct netev* self, struct netbuf_block* rbuf_b, int hint) {
+    if (rbuf_b->data == NULL) {
+        int limit = netbuf_limit(self->rbuf);
+        netbuf_reserve(self->rbuf, rbuf_b, hint < limit ? hint : limit);
+    }
+}
+
+// recv completions land in the block, the rest waits in the spill
+static void
+_uring_input(struct netev* self, struct socket* s, const char* data, int size) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    _rbuf_acquire(self, rbuf_b, size);
+    int space = netbuf_space(rbuf_b);
+    if (s->spill_size == 0 && space > 0) {
+        int n = size < space ? size : space;
+        memcpy(netbuf_wptr(rbuf_b), data, n);
+        rbuf_b->woffset += n;
+        data += n;
+        size -= n;
+    }
+    _touch(self, s);
+    if (size > 0) {
+        if (s->spill_size + size > s->spill_cap) {
+            int cap = s->spill_cap ? s->spill_cap : URING_BUFSIZE;
+            while (cap < s->spill_size + size)
+                cap *= 2;
+            s->spill = realloc(s->spill, cap);
+            s->spill_cap = cap;
+        }
+        memcpy(s->spill + s->spill_size, data, size);
+        s->spill_size += size;
+        // a block's worth waiting, stop receiving until it is read
+        if (s->spill_size > netbuf_limit(self->rbuf) && 
+            !(s->flags & SOCKET_RSTOP)) {
+            s->flags |= SOCKET_RSTOP;
+            _uring_cancel(self, _uring_ud(self, s, UOP_RECV));
+        }
+    }
+    s->flags &= ~SOCKET_WANTMORE;
+}
+
+static void
+_uring_unspill(struct netev* self, struct socket* s) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    if (s->spill_size > 0) {
+        _rbuf_acquire(self, rbuf_b, s->spill_size);
+    }
+    int space = netbuf_space(rbuf_b);
+    int n = s->spill_size < space ? s->spill_size : space;
+    if (n > 0) {
+        memcpy(netbuf_wptr(rbuf_b), s->spill, n);
+        rbuf_b->woffset += n;
+        s->spill_size -= n;
+        memmove(s->spill, s->spill + n, s->spill_size);
+    }
+    if (s->spill_size == 0 && (s->flags & SOCKET_RSTOP)) {
+        s->flags &= ~SOCKET_RSTOP;
+        if (s->rcb) {
+            _uring_recv(self, s);
+        }
+    }
+}
+
+// the message starts at roffset, all the block holds past it is its head
+static inline struct bigmsg*
+_big_begin(struct netev* self, struct socket* s, int size) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    int limit = netbuf_limit(self->rbuf);
+    struct bigmsg* b = _big_alloc(self, limit + size);
+    b->room = limit;
+    b->size = size;
+    b->head = rbuf_b->woffset - rbuf_b->roffset;
+    b->have = 0;
+    b->done = 0;
+    s->big = b;
+    STAT_INC(self, nbigmsg);
+    return b;
+}
+
+// readv into the spill and, past the message, the block. 1 once the
+// message is whole, 0 for more, -1 with self->error set
+static int
+_big_fill(struct netev* self, struct socket* s) {
+    struct bigmsg* b = s->big;
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    char* spill = b->data + b->room;
+    int left = b->size - b->head - b->have;
+    // input read into the block since comes after the spill's
+    int extra = rbuf_b->woffset - rbuf_b->roffset - b->head;
+    if (extra > 0 && left > 0) {
+        int n = extra < left ? extra : left;
+        char* p = netbuf_rptr(rbuf_b) + b->head;
+        memcpy(spill + b->have, p, n);
+        if (extra > n)
+            memmove(p, p + n, extra - n);
+        rbuf_b->woffset -= n;
+        b->have += n;
+        left -= n;
+    }
+    if (self->uring) {
+        if (left > 0 && s->spill_size > 0) {
+            int n = s->spill_size < left ? s->spill_size : left;
+            memcpy(spill + b->have, s->spill, n);
+            s->spill_size -= n;
+            memmove(s->spill, s->spill + n, s->spill_size);
+            b->have += n;
+            left -= n;
+        }
+        _uring_unspill(self, s); // what follows, or recv again
+        if (left > 0 && (s->flags & SOCKET_EOF)) {
+            self->error = NETEV_ERR_SOCKET;
+            return -1;
+        }
+        return left == 0;
+    }
+    while (left > 0) {
+        struct iovec iov[2];
+        int n = 1;
+        iov[0].iov_base = spill + b->have;
+        iov[0].iov_len = left;
+        int space = rbuf_b->data ? netbuf_space(rbuf_b) : 0;
+        if (space > 0) {
+            iov[1].iov_base = netbuf_wptr(rbuf_b);
+            iov[1].iov_len = space;
+            n++;
+        }
+        int nbyte = readv(s->fd, iov, n);
+        _stat_read(self, nbyte, errno);
+        if (nbyte > 0) {
+            _touch(self, s);
+            int m = nbyte < left ? nbyte : left;
+            b->have += m;
+            left -= m;
+            rbuf_b->woffset += nbyte - m;
+            if (nbyte < left + m + space) {
+                s->flags &= ~SOCKET_READABLE;
+                break;
+            }
+            continue;
+        }
+        if (nbyte == -1 && errno == EINTR)
+            continue;
+        if (nbyte == -1 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            s->flags &= ~SOCKET_READABLE;
+            break;
+        }
+        self->error = NETEV_ERR_SOCKET;
+        return -1;
+    }
+    return left == 0;
+}
+
+static inline int
+_oversized(struct netev* self, struct socket* s, int size) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    return self->read_limit > 0 &&
+        rbuf_b->roffset - rbuf_b->base + size > netbuf_limit(self->rbuf);
+}
+
+// netev_read past the block, the message whole or with iov in its block
+// and spill parts. NULL while incomplete, or on error with s closed
+static void*
+_read_big(struct netev* self, struct socket* s, int size, struct iovec* iov, int* niov) {
+    struct bigmsg* b = s->big;
+    if (b && b->done) {
+        _big_free(self, s); // one per netev_dropread
+        b = NULL;
+    }
+    if (size > self->read_limit || (b && b->size != size)) {
+        _close_socket(self, s);
+        self->error = NETEV_ERR_MSG;
+        return NULL;
+    }
+    if (b == NULL)
+        b = _big_begin(self, s, size);
+    int r = _big_fill(self, s);
+    if (r < 0) {
+        _close_socket(self, s);
+        return NULL;
+    }
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    if (r == 0) {
+        netbuf_rewind(rbuf_b);
+        s->flags |= SOCKET_WANTMORE;
+        _partial_begin(self, s);
+        return NULL;
+    }
+    b->done = 1;
+    s->flags &= ~SOCKET_WANTMORE;
+    char* part = b->data + b->room;
+    if (iov) {
+        int n = 0;
+        if (b->head > 0) {
+            iov[n].iov_base = netbuf_rptr(rbuf_b);
+            iov[n].iov_len = b->head;
+            n++;
+        }
+        iov[n].iov_base = part;
+        iov[n].iov_len = size - b->head;
+        *niov = n + 1;
+        rbuf_b->roffset += b->head;
+        return part;
+    }
+    if (b->head > 0)
+        memcpy(part - b->head, netbuf_rptr(rbuf_b), b->head);
+    rbuf_b->roffset += b->head;
+    return part - b->head;
+}
+
+// whether s has used its read budget this round
+static inline int
+_over_budget(struct netev* self, struct socket* s) {
+    if (s->round != self->round)
+        return 0;
+    return (self->budget_frames > 0 && s->round_frames >= self->budget_frames) ||
+        (self->budget_bytes > 0 && s->round_bytes >= self->budget_bytes);
+}
+
+// a message of size bytes is read
+static inline void
+_spend(struct netev* self, struct socket* s, int size) {
+    if (s->round != self->round) {
+        s->round = self->round;
+        s->round_frames = 0;
+        s->round_bytes = 0;
+    }
+    s->round_frames++;
+    s->round_bytes += size;
+}
+
+// the rest waits for the next round, which won't block for it. epoll
+// needn't report the socket again, the input may be all in the block
+static inline void
+_park(struct netev* self, struct socket* s) {
+    s->flags |= SOCKET_PARKED;
+    if (_link_empty(&s->ready))
+        _link_push(&self->ready, &s->ready);
+    STAT_INC(self, nparked);
+}
+
+// netev_read without a syscall, the input is already here
+static void*
+_uring_read(struct netev* self, struct socket* s, int size) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    if (netbuf_reserve(self->rbuf, rbuf_b, rbuf_b->roffset - rbuf_b->base + size) == -1) {
+        _close_socket(self, s);
+        self->error = NETEV_ERR_MSG;
+        return NULL; 
+    }
+    _uring_unspill(self, s);
+    void* rptr = netbuf_rptr(rbuf_b);
+    if (rbuf_b->woffset - rbuf_b->roffset >= size) {
+        rbuf_b->roffset += size;
+        s->flags &= ~SOCKET_WANTMORE;
+        return rptr;
+    }
+    if (s->flags & SOCKET_EOF) {
+        _close_socket(self, s);
+        self->error = NETEV_ERR_SOCKET;
+        return NULL;
+    }
+    netbuf_rewind(rbuf_b);
+    netbuf_release(self->rbuf, rbuf_b);
+    s->flags |= SOCKET_WANTMORE;
+    _partial_begin(self, s);
+    return NULL;
+}
+
 void*
 netev_read(struct netev* self, int id, int size) {
     self->error = NETEV_OK;
@@ -267,30 +1481,53 @@ netev_read(struct netev* self, int id, int size) {
     }
 
     struct netbuf_block* rbuf_b = s->rbuf_b;
+    // a new message, with the budget used up or the output too long
+    if (rbuf_b->roffset == rbuf_b->base && s->big == NULL) {
+        if (s->flags & SOCKET_PAUSED)
+            return NULL;
+        if (_over_budget(self, s)) {
+            _park(self, s);
+            return NULL;
+        }
+    }
     
-    void* rptr = (void*)rbuf_b + sizeof(*rbuf_b) + rbuf_b->roffset;
+    void* rptr = netbuf_rptr(rbuf_b);
  
     if (rbuf_b->woffset - rbuf_b->roffset >= size) {
         rbuf_b->roffset += size;
+        s->flags &= ~SOCKET_WANTMORE;
         return rptr; 
     }
+    if ((s->big && !s->big->done) || _oversized(self, s, size))
+        return _read_big(self, s, size, NULL, NULL);
+    if (self->uring)
+        return _uring_read(self, s, size);
 
-    void* wptr = (void*)rbuf_b + sizeof(*rbuf_b) + rbuf_b->woffset;
-    int space = rbuf_b->size - rbuf_b->woffset;
-    if (space < size) {
+    // a pooled block may move here
+    if (netbuf_reserve(self->rbuf, rbuf_b, rbuf_b->roffset - rbuf_b->base + size) == -1) {
         _close_socket(self, s);
         self->error = NETEV_ERR_MSG;
         return NULL; 
     }
+    rptr = netbuf_rptr(rbuf_b);
 
-    int nbyte = read(s->fd, wptr, space);
+    int space = netbuf_space(rbuf_b);
+    int nbyte = read(s->fd, netbuf_wptr(rbuf_b), space);
+    _stat_read(self, nbyte, errno);
     if (nbyte > 0) {
         rbuf_b->woffset += nbyte;
+        _touch(self, s);
+        if (nbyte < space && !(s->flags & SOCKET_SEQPACKET)) {
+            s->flags &= ~SOCKET_READABLE;
+        }
         if (rbuf_b->woffset - rbuf_b->roffset >= size) {
             rbuf_b->roffset += size;
+            s->flags &= ~SOCKET_WANTMORE;
             return rptr;
         } else {
-            rbuf_b->roffset = 0;
+            netbuf_rewind(rbuf_b);
+            s->flags |= SOCKET_WANTMORE;
+            _partial_begin(self, s);
             return NULL;
         }
     } 
@@ -301,7 +1538,11 @@ netev_read(struct netev* self, int id, int size) {
     } 
     if (errno == EAGAIN || 
         errno == EWOULDBLOCK) {
-        rbuf_b->roffset = 0;
+        netbuf_rewind(rbuf_b);
+        netbuf_release(self->rbuf, rbuf_b);
+        s->flags &= ~SOCKET_READABLE;
+        s->flags |= SOCKET_WANTMORE;
+        _partial_begin(self, s);
         return NULL;
     } else {
         _close_socket(self, s);
@@ -311,26 +1552,136 @@ netev_read(struct netev* self, int id, int size) {
     return NULL;
 }
 
+int
+netev_readv(struct netev* self, int id, int size, struct iovec* iov) {
+    self->error = NETEV_OK;
+    struct socket* s = _get_socket(self, id);
+    if (s == NULL) {
+        self->error = NETEV_ERR_INTERNAL;
+        return -1;
+    }
+    if (size > 0 && s->rbuf_b->woffset - s->rbuf_b->roffset < size &&
+        ((s->big && !s->big->done) || _oversized(self, s, size))) {
+        int n = 0;
+        if (_read_big(self, s, size, iov, &n) == NULL)
+            return self->error == NETEV_OK ? 0 : -1;
+        return n;
+    }
+    void* p = netev_read(self, id, size);
+    if (p == NULL)
+        return self->error == NETEV_OK ? 0 : -1;
+    iov[0].iov_base = p;
+    iov[0].iov_len = size;
+    return 1;
+}
+
 void
 netev_dropread(struct netev* self, int id) {
     struct socket* s = _get_socket(self, id);
     if (s == NULL)
         return;
     
+    _big_free(self, s);
     struct netbuf_block* rbuf_b = s->rbuf_b;
-    assert(rbuf_b->roffset >= 0);
-    if (rbuf_b->roffset == 0)
+    assert(rbuf_b->roffset >= rbuf_b->base);
+    if (rbuf_b->roffset == rbuf_b->base)
         return;
-    
-    int size = rbuf_b->woffset - rbuf_b->roffset;
-    if (size == 0) {
-        rbuf_b->woffset = 0;
-        rbuf_b->roffset = 0;
-    } else if (size > 0) {
-        void* buf = (void*)rbuf_b + sizeof(*rbuf_b);
-        memmove(buf, buf + rbuf_b->roffset, size);
-        rbuf_b->woffset = size;
-        rbuf_b->roffset = 0;
+    _link_remove(&s->incomplete); // a message is done
+    s->flags &= ~SOCKET_PAUSEDMSG;
+    _spend(self, s, rbuf_b->roffset - rbuf_b->base);
+    int moved = netbuf_drop(self->rbuf, rbuf_b);
+    STAT_ADD(self, ncompact, moved);
+    netbuf_release(self->rbuf, rbuf_b);
+}
+
+static inline void
+_zerocopy_push(struct socket* s, const void* data) {
+    struct zcpend* zc = s->zc;
+    if (zc == NULL || zc->count == zc->cap) {
+        int cap = zc ? zc->cap * 2 : 16;
+        struct zcpend* nzc = malloc(sizeof(*nzc) + cap * sizeof(nzc->ent[0]));
+        nzc->seq = s->zc_seq;
+        nzc->head = 0;
+        nzc->count = 0;
+        nzc->cap = cap;
+        if (zc) {
+            int i;
+            for (i=0; i<zc->count; ++i) {
+                nzc->ent[i] = zc->ent[(zc->head + i) % zc->cap];
+            }
+            nzc->seq = zc->seq;
+            nzc->count = zc->count;
+            free(zc);
+        }
+        s->zc = zc = nzc;
+    }
+    int i = (zc->head + zc->count) % zc->cap;
+    zc->ent[i].buf = data;
+    zc->ent[i].done = 0;
+    zc->count++;
+    s->zc_seq++;
+}
+
+// MSG_ZEROCOPY send, -2 to fall back to the copy path
+static inline int
+_write_zerocopy(struct netev* self, struct socket* s, const void* data, int size) {
+    if (s->flags & SOCKET_NOZC)
+        return -2;
+    if (!(s->flags & SOCKET_ZEROCOPY)) {
+        int one = 1;
+        if (setsockopt(s->fd, SOL_SOCKET, SO_ZEROCOPY, &one, sizeof(one)) == -1) {
+            s->flags |= SOCKET_NOZC;
+            return -2;
+        }
+        s->flags |= SOCKET_ZEROCOPY;
+    }
+    int nbyte = send(s->fd, data, size, MSG_ZEROCOPY);
+    _stat_write(self, nbyte, errno);
+    if (nbyte > 0) {
+        _zerocopy_push(s, data);
+        STAT_INC(self, nzerocopy);
+        return nbyte;
+    }
+    if (nbyte == -1 && errno == ENOBUFS)
+        return -2; // over optmem_max
+    return nbyte;
+}
+
+// read completions from the error queue
+static void
+_zerocopy_complete(struct netev* self, struct socket* s) {
+    char control[128];
+    for (;;) {
+        struct msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        if (recvmsg(s->fd, &msg, MSG_ERRQUEUE) == -1)
+            return;
+        struct cmsghdr* cm;
+        for (cm = CMSG_FIRSTHDR(&msg); cm; cm = CMSG_NXTHDR(&msg, cm)) {
+            struct sock_extended_err* ee = (struct sock_extended_err*)CMSG_DATA(cm);
+            if (ee->ee_errno != 0 || 
+                ee->ee_origin != SO_EE_ORIGIN_ZEROCOPY)
+                continue;
+            if (ee->ee_code & SO_EE_CODE_ZEROCOPY_COPIED) 
+                STAT_INC(self, nzerocopy_copied);
+            // [ee_info, ee_data] completed, possibly out of order
+            uint32_t seq;
+            for (seq = ee->ee_info; seq != ee->ee_data + 1; ++seq) {
+                struct zcpend* zc = s->zc;
+                if (zc == NULL)
+                    return;
+                uint32_t off = seq - zc->seq;
+                if (off >= (uint32_t)zc->count)
+                    continue;
+                int i = (zc->head + off) % zc->cap;
+                if (!zc->ent[i].done)
+                    _zerocopy_done(self, s, i);
+                if (s->status == STATUS_INVALID)
+                    return; // closed by the callback
+            }
+        }
     }
 }
 
@@ -346,8 +1697,38 @@ netev_write(struct netev* self, int id, const void* data, int size) {
         self->error = NETEV_ERR_INTERNAL;
         return -1;
     }
+    if (self->uring) {
+        // queued, no partial writes. a full queue is the EAGAIN
+        if (netev_send(self, id, data, size) == -1) {
+            if (self->error != NETEV_ERR_NOBUF)
+                return -1;
+            self->error = NETEV_OK;
+            return 0;
+        }
+        if (self->zc_threshold > 0 && size >= self->zc_threshold && self->zc_cb) {
+            // copied, as a refused zerocopy
+            uint64_t t = _cb_begin(self);
+            self->zc_cb(s->fd, id, s->data, data);
+            _cb_end(self, t);
+        }
+        return size;
+    }
 
-    int nbyte = write(s->fd, data, size);
+    int nbyte = -2;
+    int zerocopy = self->zc_threshold > 0 && size >= self->zc_threshold;
+    if (zerocopy) {
+        nbyte = _write_zerocopy(self, s, data, size);
+    }
+    if (nbyte == -2) {
+        nbyte = write(s->fd, data, size);
+        _stat_write(self, nbyte, errno);
+        if (nbyte > 0 && zerocopy && self->zc_cb) {
+            // copied after all, the buffer is free already
+            uint64_t t = _cb_begin(self);
+            self->zc_cb(s->fd, id, s->data, data);
+            _cb_end(self, t);
+        }
+    }
     if (nbyte >= 0) {
         return nbyte; 
     }
@@ -361,112 +1742,750 @@ netev_write(struct netev* self, int id, const void* data, int size) {
     }
 }
 
+// the budget ran out with connections possibly still queued, 
+// ask the kernel whether the accept queue is at its limit
+static inline void
+_check_backlog(struct netev* self, int fd) {
+    struct tcp_info info;
+    socklen_t len = sizeof(info);
+    if (!STATS || getsockopt(fd, IPPROTO_TCP, TCP_INFO, &info, &len) == -1)
+        return;
+    // for a listen socket: unacked is the accept queue, sacked its limit
+    if (info.tcpi_unacked >= info.tcpi_sacked) {
+        STAT_INC(self, nbacklog_full);
+    }
+}
+
+// one writev for as much of the queue as fits in FLUSH_IOV,
+// returns -1 on socket error, the queue is left to the caller.
+// a writev is one message on a seqpacket socket, a chunk each there
+static int
+_flush(struct netev* self, struct socket* s) {
+    struct iovec iov[FLUSH_IOV];
+    int niov = (s->flags & SOCKET_SEQPACKET) ? 1 : FLUSH_IOV;
+    int n = 0;
+    struct wchunk* c;
+    for (c = s->whead; c && n < niov; c = c->next) {
+        iov[n].iov_base = _wchunk_data(c) + c->roffset;
+        iov[n].iov_len = c->woffset - c->roffset;
+        n++;
+    }
+    if (n == 0)
+        return 0;
+    STAT_INC(self, nwritev);
+    int nbyte = writev(s->fd, iov, n);
+    _stat_write(self, nbyte, errno);
+    if (nbyte < 0) {
+        if (errno != EAGAIN && 
+            errno != EWOULDBLOCK &&
+            errno != EINTR)
+            return -1;
+        nbyte = 0;
+    }
+    s->wsize -= nbyte;
+    int left = nbyte;
+    while (left > 0) {
+        c = s->whead;
+        int size = c->woffset - c->roffset;
+        if (left < size) {
+            c->roffset += left;
+            break;
+        }
+        left -= size;
+        s->whead = c->next;
+        _free_wchunk(self, c);
+    }
+    if (s->whead == NULL) {
+        s->wtail = NULL;
+    }
+    _update_write_event(self, s);
+    _check_low(self, s);
+    return nbyte;
+}
+
+// _flush on until the kernel pushes back, where no new edge would come
 static inline int
-_accept(struct netev* self) {
-    struct sockaddr_in remote_addr;
-    socklen_t len = sizeof(remote_addr);
-    int fd = accept(self->listen_fd, (struct sockaddr*)&remote_addr, &len);
-    if (fd == -1)
+_flush_more(struct netev* self, struct socket* s) {
+    int r;
+    do {
+        r = _flush(self, s);
+    } while (r > 0 && s->wsize > 0 && (s->flags & (SOCKET_EDGE|SOCKET_SEQPACKET)));
+    return r;
+}
+
+static inline void
+_append_output(struct netev* self, struct socket* s, const void* data, int size) {
+    const char* ptr = data;
+    int left = size;
+    while (left > 0) {
+        struct wchunk* c = s->wtail;
+        if (c == NULL || c->buf || c->woffset == WCHUNK_SIZE) {
+            c = _alloc_wchunk(self);
+            if (s->wtail)
+                s->wtail->next = c;
+            else
+                s->whead = c;
+            s->wtail = c;
+        }
+        int n = WCHUNK_SIZE - c->woffset;
+        if (n > left)
+            n = left;
+        memcpy(c->data + c->woffset, ptr, n);
+        c->woffset += n;
+        ptr += n;
+        left -= n;
+    }
+    s->wsize += size;
+}
+
+// the shared payload as a chunk of its own
+static inline void
+_append_buf(struct netev* self, struct socket* s, struct netev_buf* buf) {
+    struct wchunk* c = malloc(WCHUNK_HEAD);
+    c->next = NULL;
+    c->owner = NULL;
+    c->sending = 0;
+    c->roffset = 0;
+    c->woffset = buf->size;
+    c->buf = buf;
+    __atomic_add_fetch(&buf->ref, 1, __ATOMIC_RELAXED);
+    if (s->wtail)
+        s->wtail->next = c;
+    else
+        s->whead = c;
+    s->wtail = c;
+    s->wsize += buf->size;
+}
+
+// 1 if size bytes may be queued, 0 if there is nothing to queue, -1 on error
+static inline int
+_send_check(struct netev* self, struct socket* s, int size) {
+    self->error = NETEV_OK;
+    if (s->status != STATUS_CONNECTED &&
+        s->status != STATUS_CONNECTING) {
+        self->error = NETEV_ERR_INTERNAL;
         return -1;
-    struct socket* s = _create_socket(self, fd);
-    if (s == NULL) {
-        close(fd);
+    }
+    if (s->flags & SOCKET_WERROR) {
+        _close_socket(self, s);
+        self->error = NETEV_ERR_SOCKET;
+        return -1;
+    }
+    if (size <= 0) {
+        return 0;
+    }
+    if (self->send_limit > 0 &&
+        s->wsize + size > self->send_limit) {
+        self->error = NETEV_ERR_NOBUF;
         return -1;
     }
+    return 1;
+}
 
-    if (_set_nonblocking(fd) == -1) {
+// what was queued goes out as netev_send documents
+static int
+_send_flush(struct netev* self, struct socket* s, int empty) {
+    if (self->uring) {
+        // submitted by the next netev_poll
+        if (_link_empty(&s->flush))
+            _link_push(&self->flush, &s->flush);
+        return 0;
+    }
+    if (s->status == STATUS_CONNECTING)
+        return 0; // flushed once connected
+    if (self->flags & NETEV_CORK) {
+        // flushed at the end of the netev_poll round, or before its wait
+        if (empty && _link_empty(&s->flush))
+            _link_push(&self->flush, &s->flush);
+        if (!_link_empty(&s->flush))
+            STAT_INC(self, ncorked);
+        return 0;
+    }
+    if (!empty)
+        return 0; // EPOLLOUT is armed
+    if (_flush(self, s) == -1) {
         _close_socket(self, s);
+        self->error = NETEV_ERR_SOCKET;
         return -1;
     }
-    s->status = STATUS_CONNECTED;
-    self->listen_cb(s->fd, s - self->sockets);
     return 0;
 }
 
-int
-netev_listen(struct netev* self, uint32_t addr, uint16_t port, netev_listencb cb) {
-    int fd = socket(AF_INET, SOCK_STREAM, 0);
-    if (fd == -1)
+// queue head and data together
+static int
+_send(struct netev* self, struct socket* s, const void* head, int hsize, 
+        const void* data, int size) {
+    int r = _send_check(self, s, hsize + size);
+    if (r <= 0)
+        return r;
+    int empty = s->wsize == 0;
+    if (hsize > 0)
+        _append_output(self, s, head, hsize);
+    if (size > 0)
+        _append_output(self, s, data, size);
+    if (_send_flush(self, s, empty) == -1)
         return -1;
+    _check_high(self, s);
+    return 0;
+}
 
-    if (_set_nonblocking(fd) == -1 ||
-        _set_closeonexec(fd) == -1 ||
-        _set_reuseaddr(fd)   == -1) {
-        close(fd);
-        return -1;
-    }
-    
-    struct sockaddr_in my_addr;
-    memset(&my_addr, 0, sizeof(struct sockaddr_in));
-    my_addr.sin_family = AF_INET;
-    my_addr.sin_port = htons(port);
-    my_addr.sin_addr.s_addr = addr;
-    if (bind(fd, (struct sockaddr*)&my_addr, sizeof(struct sockaddr)) == -1) {
-        close(fd);
-        return -1;
-    }   
+struct netev_buf*
+netev_buf_create(const void* data, int size) {
+    if (size < 0)
+        return NULL;
+    struct netev_buf* buf = malloc(sizeof(struct netev_buf) + size);
+    buf->ref = 1;
+    buf->size = size;
+    memcpy(buf->data, data, size);
+    return buf;
+}
 
-    if (listen(fd, LISTEN_BACKLOG) == -1) {
-        close(fd);
-        return -1;
-    }
+void
+netev_buf_release(struct netev_buf* buf) {
+    if (buf && __atomic_sub_fetch(&buf->ref, 1, __ATOMIC_ACQ_REL) == 0)
+        free(buf);
+}
 
-    struct epoll_event ev;
-    ev.events = EPOLLIN;
-    ev.data.ptr = LISTEN_SOCKET;
-    if (epoll_ctl(self->epoll_fd, EPOLL_CTL_ADD, fd, &ev) == -1) {
-        close(fd);
+int
+netev_send_buf(struct netev* self, int id, struct netev_buf* buf) {
+    struct socket* s = _get_socket(self, id);
+    int r = _send_check(self, s, buf->size);
+    if (r <= 0)
+        return r;
+    int empty = s->wsize == 0;
+    _append_buf(self, s, buf);
+    if (_send_flush(self, s, empty) == -1)
         return -1;
+    _check_high(self, s);
+    return 0;
+}
+
+int
+netev_broadcast(struct netev* self, const int* ids, int n, struct netev_buf* buf) {
+    int i, sent = 0;
+    int error = NETEV_OK;
+    for (i=0; i<n; ++i) {
+        if (netev_send_buf(self, ids[i], buf) == 0)
+            sent++;
+        else
+            error = self->error;
     }
+    self->error = error;
+    return sent;
+}
 
-    self->listen_fd = fd;
-    self->listen_cb = cb;
-    return 0;
+int
+netev_send(struct netev* self, int id, const void* data, int size) {
+    return _send(self, _get_socket(self, id), NULL, 0, data, size);
+}
+
+int
+netev_sendsize(struct netev* self, int id) {
+    return _get_socket(self, id)->wsize;
 }
 
+// header and payload size of the frame at p, 0 while the header is 
+// incomplete, -1 if it is malformed
 static inline int
-_onconnect(struct netev* self, struct socket* s) {
-    if (s->status != STATUS_CONNECTING)
-        return -1;
-    int err;
-    socklen_t errlen = sizeof(err);
-    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1) {
-        if (err == 0)
-            err = errno != 0 ? errno : -1;
-    }
-    netev_connectcb cb = (netev_connectcb)s->wcb;
-    if (err == 0) {
-        s->status = STATUS_CONNECTED;
-    }
-    if (cb) {
-        cb(s->fd, s - self->sockets, s->data, err);
-    }
-    if (err) {
-        _close_socket(self, s);
+_frame_header(int format, const uint8_t* p, int n, uint32_t* size) {
+    int i;
+    switch (format) {
+    case NETEV_FRAME_U16LE:
+        if (n < 2)
+            return 0;
+        *size = p[0] | p[1] << 8;
+        return 2;
+    case NETEV_FRAME_U16BE:
+        if (n < 2)
+            return 0;
+        *size = p[0] << 8 | p[1];
+        return 2;
+    case NETEV_FRAME_U32LE:
+        if (n < 4)
+            return 0;
+        *size = p[0] | p[1] << 8 | p[2] << 16 | (uint32_t)p[3] << 24;
+        return 4;
+    case NETEV_FRAME_U32BE:
+        if (n < 4)
+            return 0;
+        *size = (uint32_t)p[0] << 24 | p[1] << 16 | p[2] << 8 | p[3];
+        return 4;
+    case NETEV_FRAME_VARINT:
+        // at most 5 bytes, the 5th holds bits 28..31 only: anything more
+        // would wrap, it is malformed rather than a size
+        *size = 0;
+        for (i=0; i<5; ++i) {
+            if (i == n)
+                return 0;
+            if (i == 4 && (p[i] & 0xf0))
+                return -1;
+            *size |= (uint32_t)(p[i] & 0x7f) << (7 * i);
+            if (!(p[i] & 0x80))
+                return i + 1;
+        }
         return -1;
-    } else {
-        return 0;
+    }
+    return -1;
+}
+
+// the header for size, its length or -1 if size doesn't fit the format
+static inline int
+_frame_encode(int format, uint8_t* p, uint32_t size) {
+    int i;
+    switch (format) {
+    case NETEV_FRAME_U16LE:
+    case NETEV_FRAME_U16BE:
+        if (size > 0xffff)
+            return -1;
+        p[0] = format == NETEV_FRAME_U16LE ? size : size >> 8;
+        p[1] = format == NETEV_FRAME_U16LE ? size >> 8 : size;
+        return 2;
+    case NETEV_FRAME_U32LE:
+        p[0] = size;
+        p[1] = size >> 8;
+        p[2] = size >> 16;
+        p[3] = size >> 24;
+        return 4;
+    case NETEV_FRAME_U32BE:
+        p[0] = size >> 24;
+        p[1] = size >> 16;
+        p[2] = size >> 8;
+        p[3] = size;
+        return 4;
+    case NETEV_FRAME_VARINT:
+        for (i=0; size >= 0x80; ++i) {
+            p[i] = (size & 0x7f) | 0x80;
+            size >>= 7;
+        }
+        p[i] = size;
+        return i + 1;
+    }
+    return -1;
+}
+
+// hand every whole frame in the block to the callback, then compact once.
+// -1 if the socket is gone or no longer framed
+static int
+_frame_parse(struct netev* self, struct socket* s) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    netev_msgcb cb = (netev_msgcb)s->rcb;
+    int id = s - self->sockets;
+    uint32_t gen = s->gen;
+    int n = 0;
+    int need = 0;
+    for (;;) {
+        if (s->flags & SOCKET_PAUSED)
+            break;
+        if (_over_budget(self, s)) {
+            _park(self, s);
+            break;
+        }
+        int avail = rbuf_b->woffset - rbuf_b->roffset;
+        uint32_t size;
+        int hsize = _frame_header(s->frame, (uint8_t*)netbuf_rptr(rbuf_b), avail, &size);
+        if (hsize == 0)
+            break;
+        if (hsize < 0 || (size > (uint32_t)(netbuf_limit(self->rbuf) - hsize) &&
+            size > (uint32_t)self->read_limit)) {
+            _close_report(self, s, NETEV_ERR_MSG);
+            return -1;
+        }
+        if (size > (uint32_t)(netbuf_limit(self->rbuf) - hsize)) {
+            // past the block, whole in the spill or not at all
+            rbuf_b->roffset += hsize;
+            if (s->big == NULL)
+                _big_begin(self, s, size);
+            int r = _big_fill(self, s);
+            if (r < 0) {
+                _close_report(self, s, self->error);
+                return -1;
+            }
+            if (r == 0) {
+                rbuf_b->roffset -= hsize;
+                break;
+            }
+            struct bigmsg* b = s->big;
+            char* msg = b->data + b->room - b->head;
+            if (b->head > 0)
+                memcpy(msg, netbuf_rptr(rbuf_b), b->head);
+            rbuf_b->roffset += b->head;
+            n++;
+            _spend(self, s, hsize + size);
+            uint64_t t = _cb_begin(self);
+            cb(id, msg, size);
+            _cb_end(self, t);
+            if (s->gen != gen || s->status != STATUS_CONNECTED)
+                return -1;
+            _big_free(self, s);
+            if (s->rcb != (netev_readcb)cb || s->frame == 0)
+                break;
+            continue;
+        }
+        if (avail < hsize + (int)size) {
+            need = hsize + size;
+            break;
+        }
+        char* msg = netbuf_rptr(rbuf_b) + hsize;
+        rbuf_b->roffset += hsize + size;
+        n++;
+        _spend(self, s, hsize + size);
+        uint64_t t = _cb_begin(self);
+        cb(id, msg, size);
+        _cb_end(self, t);
+        if (s->gen != gen || s->status != STATUS_CONNECTED)
+            return -1; // closed by the callback
+        if (s->rcb != (netev_readcb)cb || s->frame == 0)
+            break;
+    }
+    int left = rbuf_b->woffset - rbuf_b->roffset;
+    int moved = netbuf_drop(self->rbuf, rbuf_b);
+    STAT_ADD(self, ncompact, moved);
+    if (need > 0) {
+        netbuf_reserve(self->rbuf, rbuf_b, need); // the rest of the frame
+    } else {
+        netbuf_release(self->rbuf, rbuf_b);
+    }
+    if (n > 0) {
+        _link_remove(&s->incomplete); // a message is done
+        s->flags &= ~SOCKET_PAUSEDMSG;
+    }
+    if (left > 0 && !(s->flags & (SOCKET_PARKED|SOCKET_PAUSED))) {
+        s->flags |= SOCKET_WANTMORE;
+        _partial_begin(self, s);
+    } else {
+        s->flags &= ~SOCKET_WANTMORE;
+    }
+    if (s->rcb != (netev_readcb)cb || s->frame == 0)
+        return -1;
+    return n;
+}
+
+// rcb of a framed socket: what is buffered, then one read for as many
+// frames as it brings
+static void
+_frame_read(struct netev* self, struct socket* s) {
+    int n = _frame_parse(self, s);
+    if (n < 0 || (s->flags & (SOCKET_PARKED|SOCKET_PAUSED)))
+        return;
+    if (self->uring) {
+        while (s->spill_size > 0) {
+            _uring_unspill(self, s);
+            n = _frame_parse(self, s);
+            if (n < 0)
+                return;
+            if (n == 0 || (s->flags & (SOCKET_PARKED|SOCKET_PAUSED)))
+                break;
+        }
+        if ((s->flags & (SOCKET_EOF|SOCKET_PARKED|SOCKET_PAUSED)) == SOCKET_EOF) {
+            _close_report(self, s, NETEV_ERR_SOCKET);
+        }
+        return;
+    }
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    _rbuf_acquire(self, rbuf_b, 1);
+    int space = netbuf_space(rbuf_b);
+    if (space <= 0)
+        return;
+    int nbyte = read(s->fd, netbuf_wptr(rbuf_b), space);
+    _stat_read(self, nbyte, errno);
+    if (nbyte > 0) {
+        rbuf_b->woffset += nbyte;
+        _touch(self, s);
+        if (nbyte < space && !(s->flags & SOCKET_SEQPACKET)) {
+            s->flags &= ~SOCKET_READABLE;
+        }
+        _frame_parse(self, s);
+        return;
+    }
+    if (nbyte == -1 && 
+        (errno == EAGAIN || errno == EWOULDBLOCK || errno == EINTR)) {
+        s->flags &= ~SOCKET_READABLE;
+        netbuf_release(self->rbuf, rbuf_b);
+        return;
+    }
+    _close_report(self, s, NETEV_ERR_SOCKET);
+}
+
+static inline void
+_readcb(struct netev* self, struct socket* s) {
+    s->flags &= ~SOCKET_PARKED;
+    if (s->frame) {
+        _frame_read(self, s); // each message timed
+    } else {
+        uint64_t t = _cb_begin(self);
+        s->rcb(s->fd, s - self->sockets, s->data);
+        _cb_end(self, t);
     }
 }
 
 int
-netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block, 
-        netev_connectcb cb, void* data) {
+netev_add_frame(struct netev* self, int id, int format, netev_msgcb cb, 
+        netev_writecb wcb, void* data) {
+    if (format < NETEV_FRAME_U16LE || format > NETEV_FRAME_VARINT || cb == NULL)
+        return -1;
+    int mask = NETEV_READ | (wcb ? NETEV_WRITE : 0);
+    int r = netev_add_event(self, id, mask, (netev_readcb)cb, wcb, data);
+    if (r == 0) {
+        _get_socket(self, id)->frame = format;
+    }
+    return r;
+}
+
+int
+netev_send_frame(struct netev* self, int id, const void* msg, int size) {
+    struct socket* s = _get_socket(self, id);
+    uint8_t head[5];
+    int hsize = _frame_encode(s->frame, head, size);
+    if (hsize < 0 || size < 0) {
+        self->error = NETEV_ERR_MSG;
+        return -1;
+    }
+    return _send(self, s, head, hsize, msg, size);
+}
+
+struct netev_buf*
+netev_buf_frame(int format, const void* msg, int size) {
+    uint8_t head[5];
+    int hsize = _frame_encode(format, head, size);
+    if (hsize < 0 || size < 0)
+        return NULL;
+    struct netev_buf* buf = malloc(sizeof(struct netev_buf) + hsize + size);
+    buf->ref = 1;
+    buf->size = hsize + size;
+    memcpy(buf->data, head, hsize);
+    memcpy(buf->data + hsize, msg, size);
+    return buf;
+}
+
+static inline void
+_set_class(struct netev* self, struct socket* s, int prio) {
+    self->nclassed += (prio != NETEV_PRIO_NORMAL) - (s->prio != NETEV_PRIO_NORMAL);
+    s->prio = prio;
+}
+
+static inline void
+_accepted(struct netev* self, struct socket* ls, int fd) {
+    struct socket* s = _create_socket(self, fd);
+    if (s == NULL) {
+        close(fd);
+        STAT_INC(self, naccept_nosocket);
+        return;
+    }
+    s->status = STATUS_CONNECTED;
+    s->flags |= ls->flags & SOCKET_SEQPACKET;
+    _set_class(self, s, ls->prio);
+    _set_busy_poll(self, fd);
+    s->data = ls->data; // until the callback sets its own
+    _touch(self, s);
+    STAT_INC(self, naccept);
+    uint64_t t = _cb_begin(self);
+    ((netev_listencb)ls->rcb)(s->fd, s - self->sockets);
+    _cb_end(self, t);
+}
+
+// out of fds: the reserve makes room to take one connection and close 
+// it, the peer is refused rather than left in the backlog, where it keeps
+// the listen socket ready and the loop spinning on it. -1 if there was
+// nothing to take, or no reserve
+static int
+_accept_shed(struct netev* self, struct socket* ls) {
+    if (self->reserve_fd == -1)
+        return -1;
+    close(self->reserve_fd);
+    int fd = accept4(ls->fd, NULL, NULL, SOCK_CLOEXEC);
+    if (fd >= 0) {
+        close(fd);
+        STAT_INC(self, naccept_nofd);
+    }
+    self->reserve_fd = open("/dev/null", O_RDONLY|O_CLOEXEC);
+    return fd;
+}
+
+static inline int
+_accept(struct netev* self, struct socket* ls) {
+    int n = 0;
+    while (n < self->accept_budget) {
+        int fd = accept4(ls->fd, NULL, NULL, SOCK_NONBLOCK|SOCK_CLOEXEC);
+        STAT_INC(self, naccept_call);
+        if (fd == -1) {
+            if (errno == EINTR)
+                continue; // not charged
+            if (errno == ECONNABORTED || errno == EPROTO) {
+                n++; // reset before the accept, on to the next one
+                continue;
+            }
+            if ((errno == EMFILE || errno == ENFILE) && _accept_shed(self, ls) >= 0) {
+                n++;
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK)
+                STAT_INC(self, naccept_again);
+            return n; // EAGAIN: backlog drained
+        }
+        n++;
+        _accepted(self, ls, fd);
+        if (ls->status != STATUS_LISTEN)
+            return n; // closed by the callback
+    }
+    STAT_INC(self, naccept_budget);
+    _check_backlog(self, ls->fd);
+    return n;
+}
+
+// a path, or with a leading '@' a name in the abstract namespace
+static inline int
+_unix_addr(const char* path, struct sockaddr_un* addr, socklen_t* len) {
+    size_t n = path ? strlen(path) : 0;
+    if (n == 0 || n >= sizeof(addr->sun_path))
+        return -1;
+    memset(addr, 0, sizeof(*addr));
+    addr->sun_family = AF_UNIX;
+    memcpy(addr->sun_path, path, n);
+    if (path[0] == '@') {
+        addr->sun_path[0] = '\0';
+        *len = offsetof(struct sockaddr_un, sun_path) + n;
+    } else {
+        *len = offsetof(struct sockaddr_un, sun_path) + n + 1;
+    }
+    return 0;
+}
+
+// bind fd, listen and take a slot with flags, fd is closed on failure
+static int
+_listen(struct netev* self, int fd, const struct sockaddr* addr, socklen_t len, 
+        int backlog, int flags, netev_listencb cb, void* data) {
+    if (_set_nonblocking(fd) == -1 ||
+        _set_closeonexec(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    if (bind(fd, addr, len) == -1) {
+        close(fd);
+        return -1;
+    }   
+
+    if (listen(fd, backlog > 0 ? backlog : LISTEN_BACKLOG) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    struct socket* s = _create_socket(self, fd);
+    if (s == NULL) {
+        close(fd);
+        return -1;
+    }
+    // a listen socket never reads
+    netbuf_free_block(self->rbuf, s->rbuf_b);
+    s->rbuf_b = NULL;
+
+    int r = self->uring ? 
+        _uring_accept(self, s) : // multishot
+        _add_event(self, s, EPOLLIN);
+    if (r == -1) {
+        _close_socket(self, s);
+        return -1;
+    }
+    s->status = STATUS_LISTEN;
+    s->flags |= flags;
+    s->rcb = (netev_readcb)cb;
+    s->data = data;
+    return s - self->sockets;
+}
+
+int
+netev_add_listen(struct netev* self, uint32_t addr, uint16_t port, int backlog,
+        netev_listencb cb, void* data) {
+    if (cb == NULL)
+        return -1;
     int fd = socket(AF_INET, SOCK_STREAM, 0);
     if (fd == -1)
         return -1;
- 
-    if (!block)
-        if (_set_nonblocking(fd) == -1)
-            return -1;
 
-    int status;
+    if (_set_reuseaddr(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    if ((self->flags & NETEV_REUSEPORT) &&
+        _set_reuseport(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+    
     struct sockaddr_in my_addr;
     memset(&my_addr, 0, sizeof(struct sockaddr_in));
     my_addr.sin_family = AF_INET;
     my_addr.sin_port = htons(port);
     my_addr.sin_addr.s_addr = addr;
-    int r = connect(fd, (struct sockaddr*)&my_addr, sizeof(struct sockaddr));
+    return _listen(self, fd, (struct sockaddr*)&my_addr, sizeof(my_addr), 
+            backlog, 0, cb, data);
+}
+
+int
+netev_listen_unix(struct netev* self, const char* path, int type, int backlog,
+        netev_listencb cb, void* data) {
+    struct sockaddr_un my_addr;
+    socklen_t len;
+    if (cb == NULL || 
+        (type != SOCK_STREAM && type != SOCK_SEQPACKET) ||
+        _unix_addr(path, &my_addr, &len) == -1)
+        return -1;
+    // what a previous run left behind
+    struct stat st;
+    if (path[0] != '@' && 
+        stat(path, &st) == 0 && S_ISSOCK(st.st_mode))
+        unlink(path);
+    int fd = socket(AF_UNIX, type, 0);
+    if (fd == -1)
+        return -1;
+    return _listen(self, fd, (struct sockaddr*)&my_addr, len, backlog, 
+            type == SOCK_SEQPACKET ? SOCKET_SEQPACKET : 0, cb, data);
+}
+
+int
+netev_listen(struct netev* self, uint32_t addr, uint16_t port, netev_listencb cb) {
+    return netev_add_listen(self, addr, port, LISTEN_BACKLOG, cb, NULL) >= 0 ? 0 : -1;
+}
+
+static inline int
+_onconnect(struct netev* self, struct socket* s) {
+    if (s->status != STATUS_CONNECTING)
+        return -1;
+    int err;
+    socklen_t errlen = sizeof(err);
+    if (getsockopt(s->fd, SOL_SOCKET, SO_ERROR, &err, &errlen) == -1) {
+        if (err == 0)
+            err = errno != 0 ? errno : -1;
+    }
+    netev_connectcb cb = (netev_connectcb)s->wcb;
+    if (err == 0) {
+        s->status = STATUS_CONNECTED;
+        _touch(self, s);
+    }
+    if (cb) {
+        uint64_t t = _cb_begin(self);
+        cb(s->fd, s - self->sockets, s->data, err);
+        _cb_end(self, t);
+    }
+    if (err) {
+        _close_socket(self, s);
+        return -1;
+    } else {
+        return 0;
+    }
+}
+
+// connect fd and take a slot with flags, fd is closed on failure
+static int
+_connect(struct netev* self, int fd, const struct sockaddr* addr, socklen_t len, 
+        int block, int flags, netev_connectcb cb, void* data) {
+    if (!block)
+        if (_set_nonblocking(fd) == -1) {
+            close(fd);
+            return -1;
+        }
+
+    int status;
+    int r = connect(fd, addr, len);
     if (r == -1) {
         if (block || errno != EINPROGRESS) {
             close(fd);
@@ -478,8 +2497,10 @@ netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block,
     }
 
     if (block)
-        if (_set_nonblocking(fd) == -1) // 仅connect阻塞
+        if (_set_nonblocking(fd) == -1) { // 仅connect阻塞
+            close(fd);
             return -1;
+        }
 
     struct socket* s = _create_socket(self, fd);
     if (s == NULL) {
@@ -488,8 +2509,24 @@ netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block,
     }
    
     s->status = status;
+    s->flags |= flags;
+    _set_busy_poll(self, fd);
     if (s->status == STATUS_CONNECTED) {
+        _touch(self, s);
+        s->data = data;
+        uint64_t t = _cb_begin(self);
         cb(s->fd, s-self->sockets, s->data, 0);
+        _cb_end(self, t);
+    } else if (self->uring) {
+        struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_POLL_ADD, fd, 
+                _uring_ud(self, s, UOP_CONNECT));
+        if (sqe == NULL) {
+            _close_socket(self, s);
+            return -1;
+        }
+        sqe->poll32_events = POLLOUT;
+        s->wcb = (netev_writecb)cb;
+        s->data = data; 
     } else {
         if (_add_event(self, s, EPOLLIN|EPOLLOUT) == -1) {
             _close_socket(self, s);
@@ -502,42 +2539,1218 @@ netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block,
 }
 
 int
-netev_poll(struct netev* self, int timeout) {
+netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block, 
+        netev_connectcb cb, void* data) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    if (fd == -1)
+        return -1;
+
+    struct sockaddr_in my_addr;
+    memset(&my_addr, 0, sizeof(struct sockaddr_in));
+    my_addr.sin_family = AF_INET;
+    my_addr.sin_port = htons(port);
+    my_addr.sin_addr.s_addr = addr;
+    return _connect(self, fd, (struct sockaddr*)&my_addr, sizeof(my_addr), 
+            block, 0, cb, data);
+}
+
+int
+netev_connect_unix(struct netev* self, const char* path, int type, int block, 
+        netev_connectcb cb, void* data) {
+    struct sockaddr_un my_addr;
+    socklen_t len;
+    if ((type != SOCK_STREAM && type != SOCK_SEQPACKET) ||
+        _unix_addr(path, &my_addr, &len) == -1)
+        return -1;
+    int fd = socket(AF_UNIX, type, 0);
+    if (fd == -1)
+        return -1;
+    return _connect(self, fd, (struct sockaddr*)&my_addr, len, block, 
+            type == SOCK_SEQPACKET ? SOCKET_SEQPACKET : 0, cb, data);
+}
+
+static struct dgring*
+_dgring_create() {
+    struct dgring* ring = malloc(sizeof(struct dgring));
+    ring->data = malloc(UDP_BATCH * UDP_SLOT);
+    if (ring->data == NULL) {
+        free(ring);
+        return NULL;
+    }
+    memset(ring->msg, 0, sizeof(ring->msg));
     int i;
-    int nfd = epoll_wait(self->epoll_fd, self->events, 1000/*self->max*/, timeout); 
-    for (i=0; i<nfd; ++i) {
-        struct epoll_event* ev = &self->events[i];
-        struct socket* s = ev->data.ptr;
-        if (s == LISTEN_SOCKET) {
-            _accept(self);
-            continue;
+    for (i=0; i<UDP_BATCH; ++i) {
+        struct msghdr* mh = &ring->msg[i].msg_hdr;
+        ring->iov[i].iov_base = ring->data + i * UDP_SLOT;
+        ring->iov[i].iov_len = UDP_SLOT;
+        mh->msg_iov = &ring->iov[i];
+        mh->msg_iovlen = 1;
+        mh->msg_name = &ring->from[i];
+        mh->msg_control = ring->ctrl[i];
+    }
+    return ring;
+}
+
+// the segment size of a GRO train, 0 for a single datagram
+static inline int
+_dgram_segment(struct msghdr* mh) {
+    struct cmsghdr* cm;
+    for (cm = CMSG_FIRSTHDR(mh); cm; cm = CMSG_NXTHDR(mh, cm)) {
+        if (cm->cmsg_level == SOL_UDP && cm->cmsg_type == UDP_GRO) {
+            int seg;
+            memcpy(&seg, CMSG_DATA(cm), sizeof(seg));
+            return seg;
         }
-        if (s->status == STATUS_CONNECTING) {
-            if (ev->events & EPOLLOUT) {
-                if (_onconnect(self, s) == 0) {
-                    if ((ev->events & EPOLLIN) &&
-                        s->rcb) { // 可写并且可读
-                        s->rcb(s->fd, s - self->sockets, s->data);
-                    }
-                }
+    }
+    return 0;
+}
+
+static inline int
+_dgram_stride(int size) {
+    return sizeof(struct dgram_rec) + ((size + 7) & ~7);
+}
+
+// POLLOUT is the kernel's go ahead, a one shot poll under io_uring
+static inline void
+_dgram_wait(struct netev* self, struct socket* s) {
+    if (s->flags & SOCKET_WBLOCK)
+        return;
+    int r = 0;
+    if (self->uring) {
+        struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_POLL_ADD, s->fd, 
+                _uring_ud(self, s, UOP_CONNECT));
+        if (sqe)
+            sqe->poll32_events = POLLOUT;
+        else
+            r = -1;
+    } else {
+        r = _ctl_event(self, s, EPOLLIN|EPOLLOUT);
+    }
+    if (r == 0) {
+        s->flags |= SOCKET_WBLOCK;
+    } else if (_link_empty(&s->flush)) {
+        _link_push(&self->flush, &s->flush); // tried again at the next netev_poll
+    }
+}
+
+// io_uring: multishot POLLIN, a completion puts the socket on the ready list
+static inline int
+_dgram_poll(struct netev* self, struct socket* s) {
+    struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_POLL_ADD, s->fd, 
+            _uring_ud(self, s, UOP_POLL));
+    if (sqe == NULL)
+        return -1;
+    sqe->poll32_events = POLLIN;
+    sqe->len = IORING_POLL_ADD_MULTI;
+    s->flags |= SOCKET_RECV;
+    return 0;
+}
+
+static inline void
+_dgram_writable(struct netev* self, struct socket* s) {
+    s->flags &= ~SOCKET_WBLOCK;
+    if (!self->uring)
+        _ctl_event(self, s, EPOLLIN);
+}
+
+// sendmmsg the queue, a batch at a time. with GSO a run of datagrams to
+// one address, all of the first's size but a shorter last, is one message
+static void
+_dgram_flush(struct netev* self, struct socket* s) {
+    struct mmsghdr msg[UDP_BATCH];
+    struct iovec iov[UDP_IOV];
+    struct sockaddr_in to[UDP_BATCH];
+    char ctrl[UDP_BATCH][CMSG_SPACE(sizeof(uint16_t))];
+    int end[UDP_BATCH];   // dgout offset past the message
+    int nrec[UDP_BATCH];  // its datagrams
+    int bytes[UDP_BATCH];
+
+    _link_remove(&s->flush);
+    while (s->dgout_head < s->dgout_size && !(s->flags & SOCKET_WBLOCK)) {
+        int off = s->dgout_head;
+        int n = 0;
+        int niov = 0;
+        while (off < s->dgout_size && n < UDP_BATCH && niov < UDP_IOV) {
+            struct dgram_rec* r = (struct dgram_rec*)(s->dgout + off);
+            struct msghdr* mh = &msg[n].msg_hdr;
+            memset(mh, 0, sizeof(*mh));
+            memset(&to[n], 0, sizeof(to[n]));
+            to[n].sin_family = AF_INET;
+            to[n].sin_port = htons(r->port);
+            to[n].sin_addr.s_addr = r->addr;
+            mh->msg_name = &to[n];
+            mh->msg_namelen = sizeof(to[n]);
+            mh->msg_iov = &iov[niov];
+            int seg = r->size;
+            int total = 0;
+            int k = 0;
+            for (;;) {
+                iov[niov].iov_base = r + 1;
+                iov[niov].iov_len = r->size;
+                niov++;
+                k++;
+                total += r->size;
+                off += _dgram_stride(r->size);
+                if (!(s->flags & SOCKET_GSO) || seg == 0 || r->size != seg ||
+                    off >= s->dgout_size || k == UDP_GSO_SEGS || niov == UDP_IOV)
+                    break;
+                struct dgram_rec* next = (struct dgram_rec*)(s->dgout + off);
+                if (next->addr != r->addr || next->port != r->port ||
+                    next->size == 0 || next->size > seg || total + next->size > UDP_MAX)
+                    break;
+                r = next;
             }
+            mh->msg_iovlen = k;
+            if (k > 1) {
+                mh->msg_control = ctrl[n];
+                mh->msg_controllen = sizeof(ctrl[n]);
+                struct cmsghdr* cm = CMSG_FIRSTHDR(mh);
+                cm->cmsg_level = SOL_UDP;
+                cm->cmsg_type = UDP_SEGMENT;
+                cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+                uint16_t size = seg;
+                memcpy(CMSG_DATA(cm), &size, sizeof(size));
+            }
+            end[n] = off;
+            nrec[n] = k;
+            bytes[n] = total;
+            n++;
+        }
+        int sent = sendmmsg(s->fd, msg, n, 0);
+        if (sent < 0) {
+            if (errno == EINTR)
+                continue;
+            if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                _dgram_wait(self, s);
+                break;
+            }
+            if (nrec[0] > 1 && (errno == EIO || errno == EINVAL)) {
+                s->flags &= ~SOCKET_GSO; // no segmentation on this route
+                continue;
+            }
+            // the first message is refused, the rest goes on
+            STAT_ADD(self, ndgram_drop, nrec[0]);
+            s->wsize -= bytes[0];
+            s->dgout_count -= nrec[0];
+            s->dgout_head = end[0];
             continue;
         }
-        if ((ev->events & EPOLLIN) &&
-            s->rcb &&
-            s->status == STATUS_CONNECTED) {
-            s->rcb(s->fd, s - self->sockets, s->data);
+        STAT_INC(self, nsendmmsg);
+        int i;
+        for (i=0; i<sent; ++i) {
+            s->wsize -= bytes[i];
+            s->dgout_count -= nrec[i];
+            STAT_ADD(self, ndgram_out, nrec[i]);
         }
-        if ((ev->events & EPOLLOUT) &&
-            s->wcb &&
+        s->dgout_head = end[sent-1];
+    }
+    if (s->dgout_head == s->dgout_size) {
+        s->dgout_head = 0;
+        s->dgout_size = 0;
+    }
+}
+
+// up to UDP_ROUNDS batches, 1 if input may be left. the replies the
+// callbacks queued go out as a batch after
+static int
+_dgram_read(struct netev* self, struct socket* s) {
+    struct dgring* ring = self->dgring;
+    netev_dgramcb cb = (netev_dgramcb)s->rcb;
+    int id = s - self->sockets;
+    uint32_t gen = s->gen;
+    int more = 0;
+    int round, i;
+    for (round=0; round<UDP_ROUNDS; ++round) {
+        for (i=0; i<UDP_BATCH; ++i) {
+            ring->msg[i].msg_hdr.msg_namelen = sizeof(ring->from[i]);
+            ring->msg[i].msg_hdr.msg_controllen = sizeof(ring->ctrl[i]);
+        }
+        int n = recvmmsg(s->fd, ring->msg, UDP_BATCH, MSG_DONTWAIT, NULL);
+        if (n <= 0)
+            break; // EAGAIN
+        STAT_INC(self, nrecvmmsg);
+        for (i=0; i<n; ++i) {
+            const char* p = ring->iov[i].iov_base;
+            int size = ring->msg[i].msg_len;
+            int seg = _dgram_segment(&ring->msg[i].msg_hdr);
+            if (seg <= 0)
+                seg = size;
+            uint32_t addr = ring->from[i].sin_addr.s_addr;
+            uint16_t port = ntohs(ring->from[i].sin_port);
+            int off = 0;
+            do {
+                int len = size - off < seg ? size - off : seg;
+                STAT_INC(self, ndgram_in);
+                uint64_t t = _cb_begin(self);
+                cb(id, p + off, len, addr, port, s->data);
+                _cb_end(self, t);
+                if (s->status != STATUS_DGRAM || s->gen != gen)
+                    return 0; // closed by the callback
+                off += len;
+            } while (off < size);
+        }
+        if (n < UDP_BATCH)
+            break;
+        more = round == UDP_ROUNDS - 1;
+    }
+    if (s->dgout_count > 0)
+        _dgram_flush(self, s);
+    return more;
+}
+
+int
+netev_udp(struct netev* self, uint32_t addr, uint16_t port, int flags,
+        netev_dgramcb cb, void* data) {
+    if (cb == NULL)
+        return -1;
+    if (self->dgring == NULL) {
+        self->dgring = _dgring_create();
+        if (self->dgring == NULL)
+            return -1;
+    }
+    int fd = socket(AF_INET, SOCK_DGRAM, 0);
+    if (fd == -1)
+        return -1;
+
+    if (_set_nonblocking(fd) == -1 ||
+        _set_closeonexec(fd) == -1 ||
+        _set_reuseaddr(fd)   == -1) {
+        close(fd);
+        return -1;
+    }
+    if ((self->flags & NETEV_REUSEPORT) &&
+        _set_reuseport(fd) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    struct sockaddr_in my_addr;
+    memset(&my_addr, 0, sizeof(struct sockaddr_in));
+    my_addr.sin_family = AF_INET;
+    my_addr.sin_port = htons(port);
+    my_addr.sin_addr.s_addr = addr;
+    if (bind(fd, (struct sockaddr*)&my_addr, sizeof(struct sockaddr)) == -1) {
+        close(fd);
+        return -1;
+    }
+
+    struct socket* s = _create_socket(self, fd);
+    if (s == NULL) {
+        close(fd);
+        return -1;
+    }
+    // datagrams are read into the ring
+    netbuf_free_block(self->rbuf, s->rbuf_b);
+    s->rbuf_b = NULL;
+    _set_busy_poll(self, fd);
+
+    int on = 1;
+    int zero = 0;
+    if ((flags & NETEV_UDP_GSO) &&
+        setsockopt(fd, SOL_UDP, UDP_SEGMENT, &zero, sizeof(zero)) == 0)
+        s->flags |= SOCKET_GSO;
+    if (flags & NETEV_UDP_GRO)
+        setsockopt(fd, SOL_UDP, UDP_GRO, &on, sizeof(on));
+
+    int r = self->uring ? 
+        _dgram_poll(self, s) :
+        _add_event(self, s, EPOLLIN);
+    if (r == -1) {
+        _close_socket(self, s);
+        return -1;
+    }
+    s->status = STATUS_DGRAM;
+    s->rcb = (netev_readcb)cb;
+    s->data = data;
+    return s - self->sockets;
+}
+
+int
+netev_sendto(struct netev* self, int id, const void* msg, int size,
+        uint32_t addr, uint16_t port) {
+    struct socket* s = _get_socket(self, id);
+    self->error = NETEV_OK;
+    if (s->status != STATUS_DGRAM) {
+        self->error = NETEV_ERR_INTERNAL;
+        return -1;
+    }
+    if (size < 0 || size > UDP_MAX) {
+        self->error = NETEV_ERR_MSG;
+        return -1;
+    }
+    if (self->send_limit > 0 &&
+        s->wsize + size > self->send_limit) {
+        self->error = NETEV_ERR_NOBUF;
+        return -1;
+    }
+    int need = _dgram_stride(size);
+    if (s->dgout_size + need > s->dgout_cap) {
+        if (s->dgout_head > 0) {
+            s->dgout_size -= s->dgout_head;
+            memmove(s->dgout, s->dgout + s->dgout_head, s->dgout_size);
+            s->dgout_head = 0;
+        }
+        if (s->dgout_size + need > s->dgout_cap) {
+            int cap = s->dgout_cap ? s->dgout_cap : UDP_BATCH * 256;
+            while (cap < s->dgout_size + need)
+                cap *= 2;
+            s->dgout = realloc(s->dgout, cap);
+            s->dgout_cap = cap;
+        }
+    }
+    struct dgram_rec* r = (struct dgram_rec*)(s->dgout + s->dgout_size);
+    r->addr = addr;
+    r->port = port;
+    r->size = size;
+    memcpy(r + 1, msg, size);
+    s->dgout_size += need;
+    s->dgout_count++;
+    s->wsize += size;
+    if (s->dgout_count >= UDP_BATCH) {
+        _dgram_flush(self, s);
+    } else if (_link_empty(&s->flush)) {
+        _link_push(&self->flush, &s->flush);
+    }
+    return 0;
+}
+
+// read what the callback left in the kernel, as far as the block allows
+static inline void
+_drain(struct netev* self, struct socket* s) {
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    _rbuf_acquire(self, rbuf_b, 1);
+    int space = netbuf_space(rbuf_b);
+    if (space <= 0)
+        return;
+    int nbyte = read(s->fd, netbuf_wptr(rbuf_b), space);
+    _stat_read(self, nbyte, errno);
+    if (nbyte > 0) {
+        rbuf_b->woffset += nbyte;
+        _touch(self, s);
+        s->flags &= ~SOCKET_WANTMORE;
+        if (nbyte < space && !(s->flags & SOCKET_SEQPACKET))
+            s->flags &= ~SOCKET_READABLE;
+    } else if (nbyte == -1 && 
+        (errno == EAGAIN || errno == EWOULDBLOCK)) {
+        s->flags &= ~SOCKET_READABLE;
+        netbuf_release(self->rbuf, rbuf_b);
+    }
+    // eof or error: stay readable, the next netev_read reports it
+}
+
+// an edge socket is dispatched again next round until it is drained to
+// EAGAIN and the callback has asked for more than the block holds
+static inline void
+_requeue(struct netev* self, struct socket* s) {
+    if (s->status != STATUS_CONNECTED || s->rcb == NULL || (s->flags & SOCKET_PAUSED))
+        return;
+    if (s->flags & SOCKET_READABLE) {
+        _drain(self, s);
+    }
+    struct netbuf_block* rbuf_b = s->rbuf_b;
+    if ((s->flags & SOCKET_READABLE) ||
+        (!(s->flags & SOCKET_WANTMORE) && rbuf_b->woffset > rbuf_b->roffset)) {
+        if (_link_empty(&s->ready))
+            _link_push(&self->ready, &s->ready);
+    }
+}
+
+// input is dispatched class by class once any socket is out of the 
+// default class or weights are set
+static inline int
+_classed(struct netev* self) {
+    return self->nclassed > 0 || self->weighted;
+}
+
+// onto its class's lists for this round, through the ready link: 
+// 2*prio those deferred before, first, 2*prio+1 the rest
+static inline void
+_classify(struct link* cls, struct socket* s, uint64_t wake) {
+    _link_remove(&s->ready);
+    if (s->flags & SOCKET_DEFERRED) {
+        _link_push(&cls[2*s->prio], &s->ready);
+    } else {
+        s->queued = wake;
+        _link_push(&cls[2*s->prio+1], &s->ready);
+    }
+}
+
+// past the class weight, to the next round
+static inline void
+_defer(struct netev* self, struct socket* s) {
+    s->flags = (s->flags & ~SOCKET_EVENT) | SOCKET_DEFERRED;
+    _link_push(&self->ready, &s->ready);
+    STAT_INC(self, ndeferred[s->prio]);
+}
+
+// queue the output as linked sends, one batch in flight per socket
+static void
+_uring_flush(struct netev* self, struct socket* s) {
+    if (s->nsend > 0 || s->wsize == 0 || s->status != STATUS_CONNECTED)
+        return;
+    int space = uring_space(self->uring);
+    if (space < 2) {
+        uring_enter(self->uring, 0, 0);
+        space = uring_space(self->uring);
+    }
+    // a link can't span a submit, stay within what is free
+    struct io_uring_sqe* prev = NULL;
+    struct wchunk* c;
+    for (c = s->whead; c && s->nsend < FLUSH_IOV && s->nsend < space; c = c->next) {
+        struct io_uring_sqe* sqe = _uring_prep(self, IORING_OP_SEND, s->fd, 
+                (uint64_t)(uintptr_t)c | UOP_SEND);
+        sqe->addr = (uint64_t)(uintptr_t)(_wchunk_data(c) + c->roffset);
+        sqe->len = c->woffset - c->roffset;
+        sqe->msg_flags = MSG_WAITALL | MSG_NOSIGNAL;
+        if (prev)
+            prev->flags |= IOSQE_IO_LINK;
+        prev = sqe;
+        c->owner = s;
+        c->sending = 1;
+        s->nsend++;
+    }
+}
+
+static void
+_uring_sent(struct netev* self, struct wchunk* c, int res) {
+    struct socket* s = c->owner;
+    c->sending = 0;
+    _stat_write(self, res, -res);
+    if (s == NULL) {
+        struct wchunk** p = &self->orphan;
+        while (*p != c)
+            p = &(*p)->next;
+        *p = c->next;
+        _free_wchunk(self, c);
+        return;
+    }
+    s->nsend--;
+    if (res > 0) {
+        c->roffset += res;
+        s->wsize -= res;
+    } else if (res < 0 && res != -ECANCELED && res != -EINTR && res != -EAGAIN) {
+        s->flags |= SOCKET_WERROR; // reported by the next netev_send
+    }
+    if (s->nsend > 0)
+        return;
+    while (s->whead && s->whead->roffset == s->whead->woffset) {
+        c = s->whead;
+        s->whead = c->next;
+        _free_wchunk(self, c);
+    }
+    if (s->whead == NULL) {
+        s->wtail = NULL;
+    }
+    if (s->flags & SOCKET_WERROR) {
+        _clear_output(self, s);
+    } else if (s->wsize > 0 && _link_empty(&s->flush)) {
+        _link_push(&self->flush, &s->flush); // cut short, the rest goes next round
+    }
+    _check_low(self, s);
+}
+
+static void
+_uring_received(struct netev* self, uint64_t ud, int res, uint32_t flags) {
+    struct socket* s = _uring_socket(self, ud);
+    _stat_read(self, res, -res);
+    if (flags & IORING_CQE_F_BUFFER) {
+        int bid = flags >> IORING_CQE_BUFFER_SHIFT;
+        if (s && res > 0) {
+            _uring_input(self, s, uring_buf(self->uring, bid), res);
+        }
+        uring_buf_recycle(self->uring, bid);
+    }
+    if (s == NULL)
+        return;
+    if (res == 0 || 
+        (res < 0 && res != -ECANCELED && res != -ENOBUFS)) {
+        s->flags |= SOCKET_EOF; // the next netev_read reports it
+    }
+    if (!(flags & IORING_CQE_F_MORE)) {
+        s->flags &= ~SOCKET_RECV;
+        if (s->rcb) {
+            _uring_recv(self, s); // out of buffers, or cancelled and wanted again
+        }
+    }
+    if (s->rcb && _link_empty(&s->ready) && !(s->flags & SOCKET_PAUSED) &&
+        (res > 0 || (s->flags & SOCKET_EOF))) {
+        _link_push(&self->ready, &s->ready);
+    }
+}
+
+static void
+_uring_polled(struct netev* self, uint64_t ud, int res, uint32_t flags) {
+    struct socket* s = _uring_socket(self, ud);
+    if (s && s->status == STATUS_LISTEN) {
+        if (res >= 0)
+            _uring_accept(self, s); // out of fds before, a connection waits
+        return;
+    }
+    if (s == NULL || s->status != STATUS_DGRAM)
+        return;
+    if (!(flags & IORING_CQE_F_MORE)) {
+        s->flags &= ~SOCKET_RECV;
+        if (res >= 0)
+            _dgram_poll(self, s);
+    }
+    if (res > 0 && _link_empty(&s->ready)) {
+        _link_push(&self->ready, &s->ready);
+    }
+}
+
+static void
+_uring_connected(struct netev* self, uint64_t ud) {
+    struct socket* s = _uring_socket(self, ud);
+    if (s && s->status == STATUS_DGRAM) {
+        // the POLLOUT of _dgram_wait
+        _dgram_writable(self, s);
+        _dgram_flush(self, s);
+        return;
+    }
+    if (s == NULL || _onconnect(self, s) == -1)
+        return;
+    if (s->rcb) {
+        _uring_recv(self, s);
+    }
+    if (s->wsize > 0 && _link_empty(&s->flush)) {
+        _link_push(&self->flush, &s->flush);
+    }
+}
+
+static int
+_uring_reap(struct netev* self) {
+    int n = 0;
+    struct io_uring_cqe* cqe;
+    while ((cqe = uring_cqe(self->uring)) != NULL) {
+        uint64_t ud = cqe->user_data;
+        int res = cqe->res;
+        uint32_t flags = cqe->flags;
+        uring_cqe_seen(self->uring);
+        n++;
+        switch (ud & UOP_MASK) {
+        case UOP_ACCEPT: {
+            struct socket* ls = _uring_socket(self, ud);
+            STAT_INC(self, naccept_call);
+            if (res == -EAGAIN)
+                STAT_INC(self, naccept_again);
+            if (ls == NULL) {
+                if (res >= 0)
+                    close(res);
+                break;
+            }
+            if (res >= 0) {
+                _accepted(self, ls, res);
+            } else if (res == -EMFILE || res == -ENFILE) {
+                _accept_shed(self, ls);
+                if (ls->status == STATUS_LISTEN && !(flags & IORING_CQE_F_MORE))
+                    _uring_accept_poll(self, ls);
+                break;
+            }
+            if (ls->status == STATUS_LISTEN && 
+                !(flags & IORING_CQE_F_MORE)) {
+                _uring_accept(self, ls);
+            }
+            break;
+        }
+        case UOP_RECV:
+            _uring_received(self, ud, res, flags);
+            break;
+        case UOP_CONNECT:
+            _uring_connected(self, ud);
+            break;
+        case UOP_POLL:
+            _uring_polled(self, ud, res, flags);
+            break;
+        case UOP_SEND:
+            _uring_sent(self, (struct wchunk*)(uintptr_t)(ud & ~(uint64_t)UOP_MASK), res);
+            break;
+        case UOP_CLOSE:
+            self->nclosing--;
+            break;
+        }
+    }
+    return n;
+}
+
+// every socket is closed, wait for the kernel to let go of them
+static void
+_uring_shutdown(struct netev* self) {
+    int i;
+    for (i=0; i<100 && (self->nclosing > 0 || self->orphan); ++i) {
+        if (uring_enter(self->uring, 1, 10) == -1)
+            break;
+        _uring_reap(self);
+    }
+    uring_free(self->uring);
+    self->uring = NULL;
+    while (self->orphan) {
+        struct wchunk* c = self->orphan;
+        self->orphan = c->next;
+        _free_wchunk(self, c);
+    }
+}
+
+static int
+_uring_ready(struct netev* self, struct socket* s) {
+    if (s->status == STATUS_DGRAM) {
+        // a multishot poll fires on arrivals, not on what is left
+        if (_dgram_read(self, s) && _link_empty(&s->ready))
+            _link_push(&self->ready, &s->ready);
+        return 1;
+    }
+    if (s->rcb == NULL || s->status != STATUS_CONNECTED)
+        return 0;
+    _readcb(self, s);
+    // input the callback left, same as _requeue
+    if (s->rcb && s->status == STATUS_CONNECTED && _link_empty(&s->ready) &&
+        !(s->flags & SOCKET_PAUSED) && ((s->flags & SOCKET_EOF) ||
+         (!(s->flags & SOCKET_WANTMORE) && _buffered(s) > 0))) {
+        _link_push(&self->ready, &s->ready);
+    }
+    return 1;
+}
+
+static int
+_uring_dispatch(struct netev* self, struct link* list) {
+    int n = 0;
+    while (!_link_empty(list)) {
+        struct socket* s = LINK_ENTRY(list->next, struct socket, ready);
+        _link_remove(&s->ready);
+        n += _uring_ready(self, s);
+    }
+    return n;
+}
+
+// highest class first, each up to its weight. returns the dispatches, 
+// *nrequeue those not reported by epoll this round
+static int
+_dispatch_classes(struct netev* self, struct link* cls, int* nrequeue) {
+    int n = 0;
+    int i;
+    int left = 0;
+    for (i=0; i<CLASS_LISTS; ++i) {
+        int c = i / 2;
+        if (i % 2 == 0)
+            left = self->weights[c] > 0 ? self->weights[c] : -1;
+        while (!_link_empty(&cls[i])) {
+            struct socket* s = LINK_ENTRY(cls[i].next, struct socket, ready);
+            _link_remove(&s->ready);
+            if (left == 0) {
+                _defer(self, s);
+                continue;
+            }
+            if (left > 0)
+                left--;
+            int event = s->flags & SOCKET_EVENT;
+            if (STATS && self->timing && s->queued) {
+                uint64_t wait = _monotonic_ns() - s->queued;
+                STAT_ADD(self, queue_ns[c], wait);
+                STAT_INC(self, hist_queue[c][_hist_bucket(wait)]);
+            }
+            STAT_INC(self, nclass[c]);
+            s->flags &= ~(SOCKET_EVENT | SOCKET_DEFERRED);
+            if (self->uring) {
+                if (!_uring_ready(self, s))
+                    continue;
+            } else {
+                if (s->rcb == NULL || s->status != STATUS_CONNECTED)
+                    continue;
+                _readcb(self, s);
+                // level triggered input comes again from epoll
+                if (!event || (s->flags & SOCKET_EDGE))
+                    _requeue(self, s);
+            }
+            n++;
+            if (!event)
+                (*nrequeue)++;
+        }
+    }
+    return n;
+}
+
+static int
+_uring_poll(struct netev* self, int timeout) {
+    int n = 0;
+    struct link flush;
+    _link_move(&flush, &self->flush);
+    while (!_link_empty(&flush)) {
+        struct socket* s = LINK_ENTRY(flush.next, struct socket, flush);
+        _link_remove(&s->flush);
+        if (s->status == STATUS_DGRAM)
+            _dgram_flush(self, s);
+        else
+            _uring_flush(self, s);
+    }
+    struct link pending;
+    _link_move(&pending, &self->ready);
+    if (!_link_empty(&pending) || !_link_empty(&self->writable))
+        timeout = 0;
+
+    // submit and wait in one syscall
+    STAT_INC(self, npoll);
+    uint64_t since = timeout != 0 ? _monotonic_ns() : 0;
+    if (uring_enter(self->uring, 1, timeout) == -1)
+        return -1;
+    if (timeout != 0)
+        _blocked(self, since);
+    int ncqe = _uring_reap(self);
+    if (ncqe > 0) {
+        STAT_INC(self, nwakeup);
+        STAT_ADD(self, nevent, ncqe);
+        STAT_INC(self, hist_events[_hist_bucket(ncqe)]);
+    }
+
+    struct link input;
+    _link_move(&input, &self->ready);
+    if (_classed(self)) {
+        struct link cls[CLASS_LISTS];
+        int c, nrequeue = 0;
+        for (c=0; c<CLASS_LISTS; ++c) {
+            _link_init(&cls[c]);
+        }
+        uint64_t wake = STATS && self->timing ? _monotonic_ns() : 0;
+        while (!_link_empty(&input)) {
+            struct socket* s = LINK_ENTRY(input.next, struct socket, ready);
+            s->flags |= SOCKET_EVENT;
+            _classify(cls, s, wake);
+        }
+        while (!_link_empty(&pending)) {
+            _classify(cls, LINK_ENTRY(pending.next, struct socket, ready), wake);
+        }
+        n += _dispatch_classes(self, cls, &nrequeue);
+        STAT_ADD(self, nrequeue, nrequeue);
+    } else {
+        n += _uring_dispatch(self, &input);
+        int nrequeue = _uring_dispatch(self, &pending);
+        STAT_ADD(self, nrequeue, nrequeue);
+        n += nrequeue;
+    }
+
+    // the output queue absorbs writes, so a write callback is level 
+    // triggered writability: called every round
+    struct link writable;
+    _link_move(&writable, &self->writable);
+    while (!_link_empty(&writable)) {
+        struct socket* s = LINK_ENTRY(writable.next, struct socket, writable);
+        _link_remove(&s->writable);
+        _link_push(&self->writable, &s->writable);
+        if (s->wcb && s->status == STATUS_CONNECTED) {
+            uint64_t t = _cb_begin(self);
+            s->wcb(s->fd, s - self->sockets, s->data);
+            _cb_end(self, t);
+            n++;
+        }
+    }
+    return n;
+}
+
+// epoll: datagrams, and NETEV_CORK output, each socket's queue in one 
+// writev (or sendmmsg batch) for all the round queued on it
+static void
+_flush_dirty(struct netev* self) {
+    struct link flush;
+    _link_move(&flush, &self->flush);
+    while (!_link_empty(&flush)) {
+        struct socket* s = LINK_ENTRY(flush.next, struct socket, flush);
+        _link_remove(&s->flush);
+        if (s->status == STATUS_DGRAM) {
+            _dgram_flush(self, s);
+        } else if (s->status == STATUS_CONNECTED) {
+            STAT_INC(self, ncork_flush);
+            if (_flush_more(self, s) == -1) {
+                // reported by the next netev_send
+                _clear_output(self, s);
+                s->flags |= SOCKET_WERROR;
+                _update_write_event(self, s);
+                _check_low(self, s);
+            }
+        }
+    }
+}
+
+static int
+_epoll_poll(struct netev* self, int timeout) {
+    int i, c;
+    int classed = _classed(self);
+    struct link cls[CLASS_LISTS];
+    // queued since the last round, outside netev_poll or by timers
+    _flush_dirty(self);
+
+    struct link pending;
+    _link_move(&pending, &self->ready);
+    if (!_link_empty(&pending))
+        timeout = 0;
+
+    STAT_INC(self, npoll);
+    uint64_t since = timeout != 0 ? _monotonic_ns() : 0;
+    int nfd = epoll_wait(self->epoll_fd, self->events, 1000/*self->max*/, timeout); 
+    if (timeout != 0)
+        _blocked(self, since);
+    if (nfd > 0) {
+        STAT_INC(self, nwakeup);
+        STAT_ADD(self, nevent, nfd);
+        STAT_INC(self, hist_events[_hist_bucket(nfd)]);
+    }
+    uint64_t wake = 0;
+    if (classed) {
+        for (c=0; c<CLASS_LISTS; ++c) {
+            _link_init(&cls[c]);
+        }
+        if (STATS && self->timing)
+            wake = _monotonic_ns();
+    }
+    for (i=0; i<nfd; ++i) {
+        struct epoll_event* ev = &self->events[i];
+        struct socket* s = ev->data.ptr;
+        if (s->status == STATUS_LISTEN) {
+            _accept(self, s);
+            continue;
+        }
+        if (s->status == STATUS_DGRAM) {
+            if (ev->events & EPOLLOUT) {
+                _dgram_writable(self, s);
+                _dgram_flush(self, s);
+            }
+            if ((ev->events & EPOLLIN) && s->status == STATUS_DGRAM)
+                _dgram_read(self, s); // level triggered, what is left comes again
+            continue;
+        }
+        if ((ev->events & EPOLLERR) && s->zc) {
+            _zerocopy_complete(self, s);
+            if (s->status == STATUS_INVALID)
+                continue;
+        }
+        if (s->status == STATUS_CONNECTING) {
+            if (ev->events & EPOLLOUT) {
+                if (_onconnect(self, s) == 0) {
+                    if ((ev->events & EPOLLIN) &&
+                        s->rcb) { // 可写并且可读
+                        _readcb(self, s);
+                    }
+                }
+            }
+            continue;
+        }
+        if ((ev->events & EPOLLIN) &&
+            s->rcb && !(s->flags & SOCKET_PAUSED) &&
+            s->status == STATUS_CONNECTED) {
+            if (s->flags & SOCKET_EDGE)
+                s->flags |= SOCKET_READABLE;
+            if (classed) {
+                // dispatched after the output and accepts, by class
+                s->flags |= SOCKET_EVENT;
+                _classify(cls, s, wake);
+            } else {
+                // requeued or parked, dispatched here instead
+                _link_remove(&s->ready);
+                _readcb(self, s);
+            }
+        }
+        if ((ev->events & EPOLLOUT) &&
+            s->wsize > 0 &&
             s->status == STATUS_CONNECTED) {
+            if (_flush_more(self, s) == -1) {
+                // reported by the next netev_send
+                _clear_output(self, s);
+                s->flags |= SOCKET_WERROR;
+                _update_write_event(self, s);
+                _check_low(self, s);
+            }
+        }
+        if ((ev->events & EPOLLOUT) &&
+            s->wcb &&
+            s->status == STATUS_CONNECTED) {
+            uint64_t t = _cb_begin(self);
             s->wcb(s->fd, s - self->sockets, s->data);
+            _cb_end(self, t);
+        }
+        if ((s->flags & (SOCKET_EDGE | SOCKET_EVENT)) == SOCKET_EDGE) {
+            _requeue(self, s);
+        }
+    }
+
+    int n = 0;
+    if (classed) {
+        while (!_link_empty(&pending)) {
+            _classify(cls, LINK_ENTRY(pending.next, struct socket, ready), wake);
         }
+        _dispatch_classes(self, cls, &n);
+    }
+    while (!_link_empty(&pending)) {
+        struct socket* s = LINK_ENTRY(pending.next, struct socket, ready);
+        _link_remove(&s->ready);
+        if (s->rcb == NULL || s->status != STATUS_CONNECTED)
+            continue;
+        _readcb(self, s);
+        _requeue(self, s);
+        n++;
     }
-    return nfd;
+    STAT_ADD(self, nrequeue, n);
+    _flush_dirty(self);
+    if (nfd < 0)
+        return n > 0 ? n : nfd;
+    return nfd + n;
+}
+
+static inline void
+_expire(struct netev* self, struct socket* s, int error) {
+    if (error == NETEV_ERR_TIMEOUT)
+        STAT_INC(self, nidle_closed);
+    else
+        STAT_INC(self, nmsg_closed);
+    _close_report(self, s, error);
+}
+
+// only list heads are looked at, each past its deadline is closed
+static int
+_reap(struct netev* self) {
+    int n = 0;
+    while (self->idle_timeout > 0 && !_link_empty(&self->idle)) {
+        struct socket* s = LINK_ENTRY(self->idle.next, struct socket, idle);
+        if (s->active + self->idle_timeout > self->now)
+            break;
+        _expire(self, s, NETEV_ERR_TIMEOUT);
+        n++;
+    }
+    while (self->msg_timeout > 0 && !_link_empty(&self->incomplete)) {
+        struct socket* s = LINK_ENTRY(self->incomplete.next, struct socket, incomplete);
+        if (s->partial + self->msg_timeout > self->now)
+            break;
+        _expire(self, s, NETEV_ERR_MSGTIMEOUT);
+        n++;
+    }
+    return n;
+}
+
+// ms to the first deadline, -1 none
+static int
+_reap_timeout(struct netev* self) {
+    int64_t t = -1;
+    if (self->idle_timeout > 0 && !_link_empty(&self->idle)) {
+        struct socket* s = LINK_ENTRY(self->idle.next, struct socket, idle);
+        t = (int64_t)(s->active + self->idle_timeout) - (int64_t)self->now;
+    }
+    if (self->msg_timeout > 0 && !_link_empty(&self->incomplete)) {
+        struct socket* s = LINK_ENTRY(self->incomplete.next, struct socket, incomplete);
+        int64_t m = (int64_t)(s->partial + self->msg_timeout) - (int64_t)self->now;
+        if (t < 0 || m < t)
+            t = m;
+    }
+    if (t == -1)
+        return -1;
+    return t > 0 ? t : 0;
+}
+
+static inline int
+_poll(struct netev* self, int timeout) {
+    self->round++;
+    return self->uring ? 
+        _uring_poll(self, timeout) :
+        _epoll_poll(self, timeout);
+}
+
+// zero timeout polls until one finds work or spin_us (or the timeout) 
+// passed, then the wait for the rest
+static int
+_spin(struct netev* self, int timeout) {
+    uint64_t start = _monotonic_ns();
+    uint64_t spin = (uint64_t)self->spin_us * 1000;
+    if (timeout >= 0 && (uint64_t)timeout * 1000000 < spin)
+        spin = (uint64_t)timeout * 1000000;
+    uint64_t now = start;
+    for (;;) {
+        int n = _poll(self, 0);
+        uint64_t t = _monotonic_ns();
+        if (n != 0) {
+            if (n > 0)
+                STAT_INC(self, nspin);
+            return n;
+        }
+        STAT_ADD(self, spin_ns, t - now);
+        now = t;
+        self->now = now / 1000000;
+        if (now - start >= spin)
+            break;
+    }
+    if (timeout > 0) {
+        timeout -= (now - start) / 1000000;
+        if (timeout <= 0)
+            return 0;
+    }
+    return _poll(self, timeout);
+}
+
+// the wait ends at the nearest timer or deadline, both are handled 
+// after the I/O
+int
+netev_poll(struct netev* self, int timeout) {
+    uint64_t start = _monotonic_ns();
+    uint64_t idle = self->stats.block_ns + self->stats.spin_ns;
+    self->now = start / 1000000;
+    timewheel_update(self->timer, self->now);
+    int t = timewheel_timeout(self->timer);
+    if (t >= 0 && (timeout < 0 || t < timeout))
+        timeout = t;
+    t = _reap_timeout(self);
+    if (t >= 0 && (timeout < 0 || t < timeout))
+        timeout = t;
+
+    int n = self->spin_us > 0 && timeout != 0 ?
+        _spin(self, timeout) :
+        _poll(self, timeout);
+
+    uint64_t end = _monotonic_ns();
+    self->now = end / 1000000;
+    int ntimer = timewheel_update(self->timer, self->now);
+    STAT_ADD(self, ntimer, ntimer);
+    ntimer += _reap(self);
+    if (STATS) {
+        // the timers after end are left out, to spare a clock read
+        idle = self->stats.block_ns + self->stats.spin_ns - idle;
+        uint64_t work = end - start > idle ? end - start - idle : 0;
+        STAT_ADD(self, dispatch_ns, work);
+        STAT_INC(self, hist_loop[_hist_bucket(work)]);
+    }
+    if (n < 0)
+        return ntimer > 0 ? ntimer : n;
+    return n + ntimer;
+}
+
+int
+netev_add_timer(struct netev* self, int delay, int interval, netev_timercb cb, void* data) {
+    // from the clock, not the round's start: a timer added late in a long
+    // round would fire early by the time the round took
+    return timewheel_add(self->timer, _monotonic(), delay, interval, cb, data);
+}
+
+int
+netev_del_timer(struct netev* self, int id) {
+    return timewheel_del(self->timer, id);
+}
+
+uint64_t
+netev_now(struct netev* self) {
+    return self->now;
 }
 
 int 
 netev_error(struct netev* self) {
     return self->error;
 }
+
+void*
+netev_data(struct netev* self, int id) {
+    return _get_socket(self, id)->data;
+}
+
+void
+netev_set_send_limit(struct netev* self, int limit) {
+    self->send_limit = limit > 0 ? limit : 0;
+}
+
+void
+netev_set_zerocopy(struct netev* self, int threshold, netev_zerocopycb cb) {
+    self->zc_threshold = threshold > 0 ? threshold : 0;
+    self->zc_cb = cb;
+}
+
+void
+netev_set_timeout(struct netev* self, int idle, int msg) {
+    self->idle_timeout = idle > 0 ? idle : 0;
+    self->msg_timeout = msg > 0 ? msg : 0;
+}
+
+void
+netev_set_read_limit(struct netev* self, int size) {
+    self->read_limit = size > netbuf_limit(self->rbuf) ? size : 0;
+}
+
+void
+netev_set_read_budget(struct netev* self, int frames, int bytes) {
+    self->budget_frames = frames > 0 ? frames : 0;
+    self->budget_bytes = bytes > 0 ? bytes : 0;
+}
+
+int
+netev_set_priority(struct netev* self, int id, int prio) {
+    struct socket* s = _get_socket(self, id);
+    if (s->status == STATUS_INVALID || prio < 0 || prio >= NETEV_NCLASS)
+        return -1;
+    _set_class(self, s, prio);
+    return 0;
+}
+
+void
+netev_set_weights(struct netev* self, const int* weights) {
+    int c;
+    self->weighted = 0;
+    for (c=0; c<NETEV_NCLASS; ++c) {
+        self->weights[c] = weights && weights[c] > 0 ? weights[c] : 0;
+        if (self->weights[c] > 0)
+            self->weighted = 1;
+    }
+}
+
+void
+netev_set_watermark(struct netev* self, int high, int low, netev_watermarkcb cb) {
+    self->high_watermark = high > 0 ? high : 0;
+    self->low_watermark = low >= 0 && low < high ? low : high / 2;
+    self->watermark_cb = cb;
+}
+
+void
+netev_set_closecb(struct netev* self, netev_closecb cb) {
+    self->close_cb = cb;
+}
+
+void
+netev_set_accept_budget(struct netev* self, int budget) {
+    self->accept_budget = budget > 0 ? budget : ACCEPT_BUDGET;
+}
+
+void
+netev_set_busy_poll(struct netev* self, int spin_us, int busy_poll_us) {
+    self->spin_us = spin_us > 0 ? spin_us : 0;
+    self->busy_poll = busy_poll_us > 0 ? busy_poll_us : 0;
+}
+
+void
+netev_stats(struct netev* self, struct netev_stats* st) {
+    // word by word, pairs with the relaxed stores of STAT_ADD
+    const uint64_t* src = (const uint64_t*)&self->stats;
+    uint64_t* dst = (uint64_t*)st;
+    size_t i;
+    for (i=0; i<sizeof(*st)/sizeof(uint64_t); ++i) {
+        dst[i] = __atomic_load_n(&src[i], __ATOMIC_RELAXED);
+    }
+    struct netbuf_stats bst;
+    netbuf_stats(self->rbuf, &bst); // relaxed loads too
+    st->npool_hit = bst.nhit;
+    st->npool_miss = bst.nmiss;
+    st->pool_inuse = bst.inuse;
+    st->pool_highwater = bst.highwater;
+}
+
+void
+netev_set_timing(struct netev* self, int on) {
+    self->timing = on;
+}
+
+uint64_t
+netev_hist_quantile(const uint64_t* hist, double q) {
+    uint64_t total = 0;
+    int i;
+    for (i=0; i<NETEV_HIST; ++i) {
+        total += hist[i];
+    }
+    if (total == 0)
+        return 0;
+    uint64_t rank = q * total;
+    uint64_t n = 0;
+    for (i=0; i<NETEV_HIST-1; ++i) {
+        n += hist[i];
+        if (n > rank)
+            break;
+    }
+    return 2ULL << i;
+}
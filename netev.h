@@ -3,27 +3,172 @@
 
 #include <stdint.h>
 
-#define NETEV_ERR_NOBUF
 #define NETEV_ERR_BLOCK
 #define NETEV_ERR_CLOSED
 
 #define NETEV_READ  1
 #define NETEV_WRITE 2 
+// edge triggered, as netev_add_event mask or netev_create_flags flag.
+// the library drains the socket to EAGAIN and calls rcb again on the
+// next netev_poll while input is left, so rcb must use netev_read
+#define NETEV_EDGE  4
+
+// netev_create_flags flags
+#define NETEV_REUSEPORT 0x100 // listen sockets share their port, see netgroup.h
+// io_uring backend, also picked by NETEV_BACKEND=uring in the environment
+// (then falling back to epoll without io_uring). multishot accept and recv
+// into a shared provided buffer ring, copied to the socket's block for
+// netev_read; netev_write and netev_send queue, and the queue goes out as
+// linked sends submitted with the next netev_poll's wait. as with
+// NETEV_EDGE rcb must use netev_read. edge mode, zerocopy and the accept
+// budget are epoll only
+#define NETEV_URING     0x200
+// read blocks are rings mapped twice back to back (memfd), a message that
+// wraps is still contiguous and netev_dropread never moves input. blocks
+// are rounded up to whole pages
+#define NETEV_MIRROR    0x400
+// read blocks hold a buffer from size-class pools only while input is
+// buffered, from 4 KB up to block_size as messages need, so memory follows
+// the data in flight rather than max. growing moves the block: only the
+// last netev_read's pointer stays valid. not with NETEV_MIRROR
+#define NETEV_POOL      0x800
+// the read block arena on huge pages, faulted in at create, bound to NUMA
+// node n. see netbuf.h, plain blocks only
+#define NETEV_HUGEPAGE  0x1000
+#define NETEV_PREFAULT  0x2000
+// auto-cork: netev_send and its variants only queue, and each socket
+// written to is flushed once, with one writev, after the last callback 
+// of the netev_poll round (or before the next wait, for sends from 
+// timers and outside netev_poll). netev_write is not affected. io_uring
+// submits queued output this way anyway
+#define NETEV_CORK      0x4000
+#define NETEV_NODE(n)   (((n) + 1) << 16)
+
+// netev_udp flags, quietly off where the kernel lacks them. GSO sends a
+// run of same size datagrams to one address as one message, GRO hands
+// cb the datagrams the kernel coalesced one by one as usual
+#define NETEV_UDP_GSO   1
+#define NETEV_UDP_GRO   2
+
+// frame headers for netev_add_frame: payload size, varint is LEB128
+#define NETEV_FRAME_U16LE  1
+#define NETEV_FRAME_U16BE  2
+#define NETEV_FRAME_U32LE  3
+#define NETEV_FRAME_U32BE  4
+#define NETEV_FRAME_VARINT 5
+
+// priority classes of netev_set_priority, dispatched in this order
+#define NETEV_PRIO_HIGH   0
+#define NETEV_PRIO_NORMAL 1 // default
+#define NETEV_PRIO_LOW    2
+#define NETEV_PRIO_BULK   3
+#define NETEV_NCLASS      4
 
 #define NETEV_OK            0 //正常
 #define NETEV_ERR_CONNECT   1 //连接失败
 #define NETEV_ERR_SOCKET    2
 #define NETEV_ERR_MSG       3
 #define NETEV_ERR_INTERNAL  4
+#define NETEV_ERR_NOBUF     5 //发送队列满
+#define NETEV_ERR_TIMEOUT   6 //空闲超时
+#define NETEV_ERR_MSGTIMEOUT 7 //消息不完整超时
+#define NETEV_NERR          8
 
 typedef void (*netev_listencb) (int fd, int id);
 typedef void (*netev_connectcb)(int fd, int id, void* data, int error);
 typedef void (*netev_readcb)   (int fd, int id, void* data);
 typedef void (*netev_writecb)  (int fd, int id, void* data);
+typedef void (*netev_zerocopycb)(int fd, int id, void* data, const void* buf);
+typedef void (*netev_timercb)   (int id, void* data);
+typedef void (*netev_closecb)   (int fd, int id, void* data, int error);
+typedef void (*netev_msgcb)     (int id, void* msg, int size);
+typedef void (*netev_watermarkcb)(int fd, int id, void* data, int high);
+typedef void (*netev_dgramcb)   (int id, const void* msg, int size, 
+        uint32_t addr, uint16_t port, void* data);
 
 struct netev;
+struct netev_buf;
+struct iovec;
+
+// log2 buckets: [i] counts the values v with 2^i <= v < 2^(i+1), [0]
+// also 0 and 1, the last one everything above
+#define NETEV_HIST 32
+
+// built with -DNETEV_NO_STATS netev counts and times nothing, only the
+// pool_ fields that netbuf keeps are filled in
+struct netev_stats {
+    uint64_t npoll;     // epoll_wait (io_uring_enter) calls
+    uint64_t nwakeup;   // epoll_wait returned events
+    uint64_t nevent;    // epoll events dispatched
+    uint64_t nrequeue;  // edge sockets dispatched from the internal ready list
+    uint64_t nblock;    // waits with a timeout, that may have blocked
+    uint64_t nspin;     // spins that found work, see netev_set_busy_poll
+    uint64_t block_ns;  // time in those waits
+    uint64_t spin_ns;   // time in zero timeout polls that found nothing
+    uint64_t dispatch_ns; // the rest of netev_poll: callbacks, timers, I/O
+
+    // io_uring counts completions for the calls
+    uint64_t naccept_call;      // accept4 calls
+    uint64_t naccept_again;     // that found the backlog empty
+    uint64_t nread;             // stream reads
+    uint64_t nread_bytes;
+    uint64_t nread_again;       // EAGAIN
+    uint64_t nwrite;            // stream writes, writev and send included
+    uint64_t nwrite_bytes;
+    uint64_t nwrite_again;      // EAGAIN
+    int64_t nsocket;            // sockets open: connections, listen, datagram
+    uint64_t nclose[NETEV_NERR]; // closed with the error the closecb got, 
+                                 // [NETEV_OK] by netev_close_socket
+
+    uint64_t naccept;           // connections accepted
+    uint64_t naccept_nosocket;  // accepted and closed, no free socket
+    uint64_t naccept_nofd;      // accepted and closed, out of fds
+    uint64_t naccept_budget;    // wakeups that used the whole accept budget
+    uint64_t nbacklog_full;     // of those, accept queue found at its limit
+
+    uint64_t nwritev;           // writevs of queued output
+    uint64_t ncorked;           // NETEV_CORK: sends held to the end of the round
+    uint64_t ncork_flush;       // the flushes that sent them, ncorked/ncork_flush
+                                // is the sends coalesced per flush
+    uint64_t npaused;           // input paused at the output high watermark
+
+    uint64_t nzerocopy;         // MSG_ZEROCOPY sends
+    uint64_t nzerocopy_done;    // completions
+    uint64_t nzerocopy_copied;  // notifications where the kernel copied anyway
+
+    uint64_t ntimer;            // timers fired
+    uint64_t nidle_closed;      // closed with NETEV_ERR_TIMEOUT
+    uint64_t nmsg_closed;       // closed with NETEV_ERR_MSGTIMEOUT
+
+    uint64_t ndgram_in;         // datagrams received
+    uint64_t ndgram_out;        // datagrams sent
+    uint64_t ndgram_drop;       // datagrams the kernel refused to send
+    uint64_t nrecvmmsg;         // recvmmsg calls that returned datagrams
+    uint64_t nsendmmsg;         // sendmmsg calls that sent
+
+    uint64_t ncompact;          // bytes moved to the front of read blocks
+    uint64_t nbigmsg;           // messages read past the block
+    uint64_t nparked;           // sockets held to the next round by the read budget
+    uint64_t nclass[NETEV_NCLASS];    // input dispatches by priority class, 
+                                      // counted once netev_set_priority is used
+    uint64_t ndeferred[NETEV_NCLASS]; // held to the next round by the class weight
+    uint64_t queue_ns[NETEV_NCLASS];  // ready to dispatched, with netev_set_timing
+    uint64_t npool_hit;         // NETEV_POOL buffers reused
+    uint64_t npool_miss;        // NETEV_POOL buffers malloc'd
+    int64_t pool_inuse;         // read buffer bytes held now
+    int64_t pool_highwater;     // most read buffer bytes held at once
+
+    uint64_t hist_events[NETEV_HIST];   // events per wakeup
+    uint64_t hist_loop[NETEV_HIST];     // ns of each netev_poll, less block and spin
+    uint64_t hist_callback[NETEV_HIST]; // ns of each callback, see netev_set_timing
+    uint64_t hist_queue[NETEV_NCLASS][NETEV_HIST]; // ns of each queue_ns, by class
+};
 
+// max sockets of every kind: a listen socket takes a slot like a
+// connection does, so a netev for n connections behind one listener
+// needs max n+1
 struct netev* netev_create(int max, int block_size);
+struct netev* netev_create_flags(int max, int block_size, int flags);
 void netev_free(struct netev* self);
 
 int netev_poll(struct netev* self, int timeout);
@@ -31,10 +176,136 @@ int netev_add_event(struct netev* self, int id, int mask, netev_readcb rcb, nete
 int netev_del_event(struct netev* self, int id);
 void* netev_read(struct netev* self, int id, int size);
 int netev_write(struct netev* self, int id, const void* data, int size);
+// queue data on the socket's output, flushed with writev, EPOLLOUT is armed
+// while anything is pending. don't mix with netev_write on one socket
+int netev_send(struct netev* self, int id, const void* data, int size);
+int netev_sendsize(struct netev* self, int id); // bytes pending
 void netev_dropread(struct netev* self, int id);
+// messages up to size bytes may be larger than the block: the part in
+// the block stays, the rest is read with readv into a pooled spill. 
+// netev_read then returns the message whole (copying the block's part
+// in front), valid until netev_dropread; one such message per dropread.
+// a frame is delivered the same way. 0 (default) closes with NETEV_ERR_MSG
+void netev_set_read_limit(struct netev* self, int size);
+// netev_read as up to 2 iovecs, the block's part and the spill's, without
+// joining them. returns how many, 0 while incomplete, -1 on error
+int netev_readv(struct netev* self, int id, int size, struct iovec* iov);
+// a socket reads at most frames messages, or the message that takes it 
+// past bytes, per netev_poll round, 0 no limit (default). past it 
+// netev_read returns NULL at the next message's start, with NETEV_OK, 
+// and a framed socket stops delivering. the socket is dispatched again
+// next round, which then doesn't block. a message is one that ends in
+// netev_dropread, or a frame
+void netev_set_read_budget(struct netev* self, int frames, int bytes);
+// the socket's priority class, NETEV_PRIO_NORMAL by default, sockets 
+// accepted take the listen socket's. once a socket is out of the default
+// class, or weights are set, each round dispatches input class by class,
+// NETEV_PRIO_HIGH first, after accepts and output. the wait from the 
+// wakeup to the dispatch is queue_ns. -1 for a bad class
+int netev_set_priority(struct netev* self, int id, int prio);
+// weighted round robin: weights[c] > 0 lets class c dispatch at most that
+// many sockets per round, the rest wait for the next round (which does not
+// block) and are dispatched then in class order again. a busy class no
+// longer holds the ones below for all its backlog, and a bulk backlog no
+// longer holds off the next wakeup. NULL or 0 no limit (default)
+void netev_set_weights(struct netev* self, const int* weights);
+// framing instead of a read callback: netev reads and hands cb every 
+// whole frame's payload, pointing into the read block and valid during
+// the call only. all frames a read brings are delivered before the block
+// is compacted once. eof, errors and bad frames (NETEV_ERR_MSG, also a 
+// frame larger than the block) go to the close callback. wcb may be NULL
+int netev_add_frame(struct netev* self, int id, int format, netev_msgcb cb, 
+        netev_writecb wcb, void* data);
+// netev_send with the socket's frame header in front
+int netev_send_frame(struct netev* self, int id, const void* msg, int size);
+// an immutable payload queued on many sockets without a copy each. the
+// creator holds one reference, every queued send another, it is freed
+// when the last is released. references are atomic, a buf may go to
+// several netevs of a netgroup
+struct netev_buf* netev_buf_create(const void* data, int size);
+struct netev_buf* netev_buf_frame(int format, const void* msg, int size); // header included
+void netev_buf_release(struct netev_buf* buf);
+// netev_send of the whole buf, referenced until it is sent
+int netev_send_buf(struct netev* self, int id, struct netev_buf* buf);
+// netev_send_buf to each id, returns how many queued it. a socket that
+// fails is skipped, netev_error tells the last error
+int netev_broadcast(struct netev* self, const int* ids, int n, struct netev_buf* buf);
 int netev_listen(struct netev* self, uint32_t addr, uint16_t port, netev_listencb cb);
+// returns the listen socket id, closed with netev_close_socket. 
+// it takes a slot of max. accepted sockets start with data as their data
+int netev_add_listen(struct netev* self, uint32_t addr, uint16_t port, int backlog, 
+        netev_listencb cb, void* data);
 int netev_connect(struct netev* self, uint32_t addr, uint16_t port, int block, netev_connectcb cb, void* data);
+// AF_UNIX peers on the same host, as netev_add_listen and netev_connect
+// but by path, a leading '@' names one in the abstract namespace. a stale
+// socket file at path is replaced. type is SOCK_STREAM, or SOCK_SEQPACKET
+// which keeps message boundaries: a netev_write is one message, queued 
+// output goes out a chunk (8 KB) per message, and one read takes at most
+// one message, what of it does not fit the block's free space (or 16 KB
+// under io_uring) is lost. accepted and connected sockets are used as 
+// TCP's are after, zerocopy falls back to copying
+int netev_listen_unix(struct netev* self, const char* path, int type, int backlog,
+        netev_listencb cb, void* data);
+int netev_connect_unix(struct netev* self, const char* path, int type, int block, 
+        netev_connectcb cb, void* data);
+// a UDP socket bound to addr:port (0 any), in the same table and netev_poll 
+// as the streams, shares its port under NETEV_REUSEPORT. returns the id, 
+// closed with netev_close_socket. input is taken with recvmmsg, a batch at
+// a time, into a ring of the netev and handed to cb datagram by datagram,
+// valid during the call. addr is in network order, port in host order
+int netev_udp(struct netev* self, uint32_t addr, uint16_t port, int flags,
+        netev_dgramcb cb, void* data);
+// queue one datagram (up to 65507 bytes) to addr:port. the queue goes out
+// with sendmmsg once it holds a batch, after the socket's input callbacks, 
+// or at the next netev_poll. a datagram the kernel refuses is dropped
+int netev_sendto(struct netev* self, int id, const void* msg, int size, 
+        uint32_t addr, uint16_t port);
 void netev_close_socket(struct netev* self, int id);
 int netev_error(struct netev* self);
+void* netev_data(struct netev* self, int id);
+// netev_write of at least threshold bytes (0 off) uses MSG_ZEROCOPY: the 
+// buffer belongs to the kernel until cb gets it back, read from the error
+// queue in netev_poll, so the socket must be added with netev_add_event.
+// every such write that returns > 0 gets one cb, from inside netev_write 
+// if the kernel refused zerocopy. on close every pending buffer is handed back
+void netev_set_zerocopy(struct netev* self, int threshold, netev_zerocopycb cb);
+void netev_set_send_limit(struct netev* self, int limit); // pending bytes per socket, 0 no limit
+// flow control by TCP: once a connection's queued output reaches high 
+// bytes its input is paused, EPOLLIN off (the recv cancelled under 
+// io_uring), netev_read returns NULL with NETEV_OK at the next message
+// and frames stop. at low bytes or under it input resumes, and what was
+// buffered meanwhile is dispatched the next round. cb, if not NULL, is 
+// called at each crossing, high 1 then 0, from inside the netev_send 
+// that crossed or from the flush. low past high is taken as high/2. 
+// keep high under the send limit, high 0 off (default)
+void netev_set_watermark(struct netev* self, int high, int low, netev_watermarkcb cb);
+// close connections without input for idle ms (NETEV_ERR_TIMEOUT), or
+// whose netev_read has been waiting for the rest of a message for msg ms
+// (NETEV_ERR_MSGTIMEOUT), a message ends with netev_dropread. 0 off.
+// checked from netev_poll at O(1) per connection closed
+void netev_set_timeout(struct netev* self, int idle, int msg);
+// called after netev closed a socket on its own, with the error
+void netev_set_closecb(struct netev* self, netev_closecb cb);
+void netev_set_accept_budget(struct netev* self, int budget); // accepts per wakeup
+// a netev_poll that may wait first polls with zero timeout for up to 
+// spin_us, trading a core for the wakeup when work comes within it. 
+// busy_poll_us > 0 sets SO_BUSY_POLL and SO_PREFER_BUSY_POLL on new 
+// sockets, so their reads poll the device queue (values past 
+// net.core.busy_read need CAP_NET_ADMIN, quietly unset otherwise)
+void netev_set_busy_poll(struct netev* self, int spin_us, int busy_poll_us);
+// timers on a hierarchical wheel, fired from netev_poll, whose wait ends
+// at the nearest one. cb after delay ms, then every interval ms if 
+// interval > 0. returns the timer id, a one-shot's is gone once it fired
+int netev_add_timer(struct netev* self, int delay, int interval, netev_timercb cb, void* data);
+int netev_del_timer(struct netev* self, int id);
+uint64_t netev_now(struct netev* self); // monotonic ms, cached by netev_poll
+// a snapshot, safe from another thread while the loop runs: each counter
+// is whole, though they are not all from the same instant
+void netev_stats(struct netev* self, struct netev_stats* st);
+// time every callback into hist_callback, two clock reads each. off by default
+void netev_set_timing(struct netev* self, int on);
+// the upper bound of the bucket holding quantile q (0..1) of a histogram,
+// 0 if it is empty
+uint64_t netev_hist_quantile(const uint64_t* hist, double q);
 
 #endif
@@ -0,0 +1,277 @@
+#include "netev_uring.h"
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <errno.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#define BUF_GROUP 0
+
+struct uring {
+    int fd;
+
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned* sq_array;
+    unsigned sq_mask;
+    unsigned sq_entries;
+    unsigned sq_local;  // our tail, published on enter
+    struct io_uring_sqe* sqes;
+
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+
+    void* sq_ptr;
+    size_t sq_size;
+    void* cq_ptr;
+    size_t cq_size;
+    size_t sqes_size;
+
+    struct io_uring_buf_ring* br;
+    size_t br_size;
+    unsigned br_mask;
+    unsigned short br_tail;
+    char* bufs;
+    int nbuf;
+    int buf_size;
+};
+
+static inline int
+_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+static inline int
+_register(int fd, unsigned op, void* arg, unsigned n) {
+    return syscall(__NR_io_uring_register, fd, op, arg, n);
+}
+
+static inline void
+_add_buf(struct uring* self, int bid) {
+    struct io_uring_buf* b = &self->br->bufs[self->br_tail & self->br_mask];
+    b->addr = (uint64_t)(uintptr_t)(self->bufs + (size_t)bid * self->buf_size);
+    b->len = self->buf_size;
+    b->bid = bid;
+    self->br_tail++;
+}
+
+static inline void
+_publish_bufs(struct uring* self) {
+    __atomic_store_n(&self->br->tail, self->br_tail, __ATOMIC_RELEASE);
+}
+
+static int
+_setup_bufs(struct uring* self, int nbuf, int buf_size) {
+    self->nbuf = nbuf;
+    self->buf_size = buf_size;
+    self->br_mask = nbuf - 1;
+    self->br_size = nbuf * sizeof(struct io_uring_buf);
+    self->br = mmap(NULL, self->br_size, PROT_READ|PROT_WRITE,
+            MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
+    if (self->br == MAP_FAILED) {
+        self->br = NULL;
+        return -1;
+    }
+    self->bufs = malloc((size_t)nbuf * buf_size);
+    if (self->bufs == NULL)
+        return -1;
+
+    struct io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)(uintptr_t)self->br;
+    reg.ring_entries = nbuf;
+    reg.bgid = BUF_GROUP;
+    if (_register(self->fd, IORING_REGISTER_PBUF_RING, &reg, 1) == -1)
+        return -1;
+
+    int i;
+    for (i=0; i<nbuf; ++i) {
+        _add_buf(self, i);
+    }
+    _publish_bufs(self);
+    return 0;
+}
+
+struct uring*
+uring_create(unsigned entries, int nbuf, int buf_size) {
+    if (nbuf <= 0 || (nbuf & (nbuf - 1)) || nbuf > 32768)
+        return NULL;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+    p.flags = IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN;
+    int fd = _setup(entries, &p);
+    if (fd == -1 && errno == EINVAL) {
+        memset(&p, 0, sizeof(p));
+        fd = _setup(entries, &p);
+    }
+    if (fd == -1)
+        return NULL;
+    if (!(p.features & IORING_FEAT_EXT_ARG) ||
+        !(p.features & IORING_FEAT_NODROP)) {
+        close(fd);
+        return NULL;
+    }
+
+    struct uring* u = malloc(sizeof(struct uring));
+    memset(u, 0, sizeof(*u));
+    u->fd = fd;
+
+    u->sq_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_size > u->sq_size)
+            u->sq_size = u->cq_size;
+        u->cq_size = u->sq_size;
+    }
+    u->sq_ptr = mmap(NULL, u->sq_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (u->sq_ptr == MAP_FAILED) {
+        u->sq_ptr = NULL;
+        goto err;
+    }
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ptr = u->sq_ptr;
+    } else {
+        u->cq_ptr = mmap(NULL, u->cq_size, PROT_READ|PROT_WRITE,
+                MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (u->cq_ptr == MAP_FAILED) {
+            u->cq_ptr = NULL;
+            goto err;
+        }
+    }
+    u->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(NULL, u->sqes_size, PROT_READ|PROT_WRITE,
+            MAP_SHARED|MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        u->sqes = NULL;
+        goto err;
+    }
+
+    char* sq = u->sq_ptr;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_entries = *(unsigned*)(sq + p.sq_off.ring_entries);
+    u->sq_local = *u->sq_tail;
+
+    char* cq = u->cq_ptr;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    if (_setup_bufs(u, nbuf, buf_size) == -1)
+        goto err;
+    return u;
+err:
+    uring_free(u);
+    return NULL;
+}
+
+void
+uring_free(struct uring* self) {
+    if (self == NULL)
+        return;
+    if (self->sqes)
+        munmap(self->sqes, self->sqes_size);
+    if (self->cq_ptr && self->cq_ptr != self->sq_ptr)
+        munmap(self->cq_ptr, self->cq_size);
+    if (self->sq_ptr)
+        munmap(self->sq_ptr, self->sq_size);
+    close(self->fd);
+    if (self->br)
+        munmap(self->br, self->br_size);
+    free(self->bufs);
+    free(self);
+}
+
+struct io_uring_sqe*
+uring_sqe(struct uring* self) {
+    unsigned head = __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+    if (self->sq_local - head >= self->sq_entries) {
+        if (uring_enter(self, 0, 0) == -1)
+            return NULL;
+        head = __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+        if (self->sq_local - head >= self->sq_entries)
+            return NULL;
+    }
+    unsigned idx = self->sq_local & self->sq_mask;
+    struct io_uring_sqe* sqe = &self->sqes[idx];
+    memset(sqe, 0, sizeof(*sqe));
+    self->sq_array[idx] = idx;
+    self->sq_local++;
+    return sqe;
+}
+
+int
+uring_pending(struct uring* self) {
+    return self->sq_local - __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+}
+
+int
+uring_space(struct uring* self) {
+    return self->sq_entries - uring_pending(self);
+}
+
+int
+uring_enter(struct uring* self, int wait, int timeout) {
+    // entries a failed enter left behind are still between head and tail
+    unsigned submit = self->sq_local - __atomic_load_n(self->sq_head, __ATOMIC_ACQUIRE);
+    __atomic_store_n(self->sq_tail, self->sq_local, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    struct __kernel_timespec ts;
+    struct io_uring_getevents_arg arg;
+    memset(&arg, 0, sizeof(arg));
+    arg.sigmask_sz = _NSIG / 8;
+    if (wait) {
+        flags |= IORING_ENTER_GETEVENTS | IORING_ENTER_EXT_ARG;
+        if (timeout >= 0) {
+            ts.tv_sec = timeout / 1000;
+            ts.tv_nsec = (timeout % 1000) * 1000000LL;
+            arg.ts = (uint64_t)(uintptr_t)&ts;
+        }
+    }
+    if (submit == 0 && !wait)
+        return 0;
+    int r = syscall(__NR_io_uring_enter, self->fd, submit, wait ? 1 : 0, flags,
+            wait ? (void*)&arg : NULL, wait ? sizeof(arg) : 0);
+    if (r == -1) {
+        if (errno == ETIME || errno == EINTR ||
+            errno == EAGAIN || errno == EBUSY)
+            return 0;
+        return -1;
+    }
+    return r;
+}
+
+struct io_uring_cqe*
+uring_cqe(struct uring* self) {
+    unsigned head = *self->cq_head;
+    unsigned tail = __atomic_load_n(self->cq_tail, __ATOMIC_ACQUIRE);
+    if (head == tail)
+        return NULL;
+    return &self->cqes[head & self->cq_mask];
+}
+
+void
+uring_cqe_seen(struct uring* self) {
+    __atomic_store_n(self->cq_head, *self->cq_head + 1, __ATOMIC_RELEASE);
+}
+
+void*
+uring_buf(struct uring* self, int bid) {
+    return self->bufs + (size_t)bid * self->buf_size;
+}
+
+void
+uring_buf_recycle(struct uring* self, int bid) {
+    _add_buf(self, bid);
+    _publish_bufs(self);
+}
@@ -0,0 +1,30 @@
+#ifndef __NETEV_URING_H__
+#define __NETEV_URING_H__
+
+// io_uring ring for the NETEV_URING backend of netev.c, raw syscalls.
+// one provided buffer ring (group 0) feeds every multishot recv
+
+#include <stdint.h>
+#include <linux/io_uring.h>
+
+struct uring;
+
+struct uring* uring_create(unsigned entries, int nbuf, int buf_size);
+void uring_free(struct uring* self);
+
+// NULL only if the SQ is full and submitting it failed
+struct io_uring_sqe* uring_sqe(struct uring* self);
+
+// submit what is queued, wait for at least one completion when wait is
+// set, up to timeout ms (-1 forever)
+int uring_enter(struct uring* self, int wait, int timeout);
+int uring_pending(struct uring* self); // SQEs not submitted yet
+int uring_space(struct uring* self);   // SQEs that can be queued without a submit
+
+struct io_uring_cqe* uring_cqe(struct uring* self); // NULL when empty
+void uring_cqe_seen(struct uring* self);
+
+void* uring_buf(struct uring* self, int bid);
+void uring_buf_recycle(struct uring* self, int bid);
+
+#endif
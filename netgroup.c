@@ -0,0 +1,156 @@
+#define _GNU_SOURCE
+#include "netgroup.h"
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <sched.h>
+
+#define POLL_TIMEOUT 10
+
+struct loop {
+    struct netgroup* group;
+    int index;
+    int cpu;
+    struct netev* ne;
+    pthread_t thread;
+};
+
+struct netgroup {
+    int n;
+    int running;
+    int stop;
+
+    netgroup_initcb init;
+    netgroup_tickcb tick;
+    void* ud;
+
+    struct loop loops[0];
+};
+
+static void*
+_loop_main(void* arg) {
+    struct loop* l = arg;
+    struct netgroup* g = l->group;
+    if (l->cpu >= 0) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(l->cpu, &set);
+        pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+    }
+    if (g->init) {
+        g->init(l->ne, l->index, g->ud);
+    }
+    while (!__atomic_load_n(&g->stop, __ATOMIC_RELAXED)) {
+        netev_poll(l->ne, POLL_TIMEOUT);
+        if (g->tick) {
+            g->tick(l->ne, l->index, g->ud);
+        }
+    }
+    return NULL;
+}
+
+struct netgroup*
+netgroup_create(int n, int max, int block_size, int flags) {
+    if (n <= 0)
+        return NULL;
+    struct netgroup* g = malloc(sizeof(struct netgroup) + n * sizeof(struct loop));
+    memset(g, 0, sizeof(struct netgroup) + n * sizeof(struct loop));
+    g->n = n;
+    int i;
+    for (i=0; i<n; ++i) {
+        struct loop* l = &g->loops[i];
+        l->group = g;
+        l->index = i;
+        l->cpu = -1;
+        l->ne = netev_create_flags(max, block_size, flags | NETEV_REUSEPORT);
+        if (l->ne == NULL) {
+            netgroup_free(g);
+            return NULL;
+        }
+    }
+    return g;
+}
+
+void
+netgroup_free(struct netgroup* self) {
+    if (self == NULL)
+        return;
+    netgroup_stop(self);
+    int i;
+    for (i=0; i<self->n; ++i) {
+        netev_free(self->loops[i].ne);
+    }
+    free(self);
+}
+
+int
+netgroup_size(struct netgroup* self) {
+    return self->n;
+}
+
+struct netev*
+netgroup_netev(struct netgroup* self, int index) {
+    if (index < 0 || index >= self->n)
+        return NULL;
+    return self->loops[index].ne;
+}
+
+int
+netgroup_listen(struct netgroup* self, uint32_t addr, uint16_t port, int backlog,
+        netev_listencb cb, void* data) {
+    // the loop threads own their socket tables once started. port 0
+    // would give every loop an ephemeral port of its own
+    if (self->running || port == 0)
+        return -1;
+    int ids[self->n];
+    int i;
+    for (i=0; i<self->n; ++i) {
+        ids[i] = netev_add_listen(self->loops[i].ne, addr, port, backlog, cb, data);
+        if (ids[i] < 0) {
+            // all loops or none, the ones already listening would take
+            // a share of the connections
+            while (--i >= 0) {
+                netev_close_socket(self->loops[i].ne, ids[i]);
+            }
+            return -1;
+        }
+    }
+    return 0;
+}
+
+int
+netgroup_start(struct netgroup* self, const int* cpus,
+        netgroup_initcb init, netgroup_tickcb tick, void* ud) {
+    if (self->running)
+        return -1;
+    self->init = init;
+    self->tick = tick;
+    self->ud = ud;
+    self->stop = 0;
+    int i;
+    for (i=0; i<self->n; ++i) {
+        struct loop* l = &self->loops[i];
+        l->cpu = cpus ? cpus[i] : -1;
+        if (pthread_create(&l->thread, NULL, _loop_main, l) != 0) {
+            __atomic_store_n(&self->stop, 1, __ATOMIC_RELAXED);
+            while (--i >= 0) {
+                pthread_join(self->loops[i].thread, NULL);
+            }
+            return -1;
+        }
+    }
+    self->running = 1;
+    return 0;
+}
+
+void
+netgroup_stop(struct netgroup* self) {
+    if (!self->running)
+        return;
+    __atomic_store_n(&self->stop, 1, __ATOMIC_RELAXED);
+    int i;
+    for (i=0; i<self->n; ++i) {
+        pthread_join(self->loops[i].thread, NULL);
+    }
+    self->running = 0;
+}
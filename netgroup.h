@@ -0,0 +1,34 @@
+#ifndef __NETGROUP_H__
+#define __NETGROUP_H__
+
+#include "netev.h"
+
+// N netev loops, one thread each. every loop owns its socket table and
+// netbuf arena and listens on the same port via SO_REUSEPORT, so the
+// kernel spreads inbound connections and the loops share nothing.
+// callbacks run on the loop thread, keep per loop state thread local.
+
+typedef void (*netgroup_initcb)(struct netev* ne, int index, void* ud);
+typedef void (*netgroup_tickcb)(struct netev* ne, int index, void* ud);
+
+struct netgroup;
+
+// max is per loop, as netev_create: the loop's listen sockets included
+struct netgroup* netgroup_create(int n, int max, int block_size, int flags);
+void netgroup_free(struct netgroup* self);
+
+int netgroup_size(struct netgroup* self);
+struct netev* netgroup_netev(struct netgroup* self, int index);
+
+// listen on every loop, call before netgroup_start (-1 after it). port
+// must not be 0, the loops have to share one
+int netgroup_listen(struct netgroup* self, uint32_t addr, uint16_t port, int backlog,
+        netev_listencb cb, void* data);
+
+// cpus: NULL, or n cpu numbers to pin the loops to (-1 not pinned).
+// init is called on each loop thread before polling, tick after each netev_poll
+int netgroup_start(struct netgroup* self, const int* cpus,
+        netgroup_initcb init, netgroup_tickcb tick, void* ud);
+void netgroup_stop(struct netgroup* self);
+
+#endif
@@ -1,5 +1,5 @@
 #include "netev.h"
-#include "netbuf.h"
+#include "netgroup.h"
 #include <arpa/inet.h>
 #include <string.h>
 #include <stdio.h>
@@ -11,23 +11,41 @@
 #include <time.h>
 #include <signal.h>
 
+#define IDLE_TIMEOUT (60*1000)
+#define MSG_TIMEOUT  (10*1000)
+
+#define RATE_WINDOW 1000 // ms
+#define RATE_ALPHA  0.25 // weight of the window just over
+#define TOP_K       8
+#define READ_BUDGET 64   // frames per connection per loop round
+
 #pragma pack(1)
 struct msg_header {
     uint16_t size;
 };
 #pragma pack()
 
+// bytes/s, an EWMA over RATE_WINDOW windows. a window is folded in by 
+// the first add after it, so a rate only moves once per window
+struct rate {
+    uint64_t window; // the one bytes counts
+    uint64_t bytes;
+    double ewma;
+};
+
 struct client {
     int conn_id;
-    struct netbuf_block* wbuf_b;
-    int rstat;
-    int wstat;
+    int active;
+    int heap;        // slot in the top-K heap, -1 not there
+    uint64_t rtotal;
+    uint64_t wtotal;
+    struct rate rrate;
+    struct rate wrate;
     uint64_t create_time;
 };
 
 struct server {
     struct netev* ne;
-    struct netbuf* wbuf;
     struct client* clients;
     struct client* free_client;
 
@@ -36,25 +54,159 @@ struct server {
     int nwclosed;
     int nrclosed;
     int nhclosed;
-
-    int rrate;
-    int wrate;
+    int ntclosed;
 
     uint32_t this_read;
     uint32_t this_write;
 
     uint32_t this_read_times;
     uint32_t this_write_times;
+
+    // kept as traffic comes, a report costs O(TOP_K)
+    int nclient;
+    uint64_t rtotal;
+    uint64_t wtotal;
+    struct rate rrate;
+    struct rate wrate;
+    struct client* top[TOP_K]; // min-heap on _weight
+    int ntop;
+
+    int index;
+    uint64_t last_report;
+    struct netev_stats last; // netev_stats at the last report
+};
+
+struct config {
+    int max;
+    int buf_size;
+    int udp;        // 0 tcp, else netev_udp flags + 1
+    int spin;       // us of zero timeout polls before blocking
+    uint32_t addr;  // udp: every loop binds its own socket
+    uint16_t port;
 };
 
-static uint64_t 
-get_time() {
-    struct timespec ts;
-    clock_gettime(CLOCK_MONOTONIC, &ts);
-    return ts.tv_sec * 1000 + ts.tv_nsec /1000000;
+static __thread struct server* s = NULL; // one per loop thread
+
+static inline void
+_rate_fold(struct rate* r, uint64_t now) {
+    uint64_t w = now / RATE_WINDOW;
+    if (w <= r->window)
+        return;
+    r->ewma += RATE_ALPHA * (r->bytes * 1000.0 / RATE_WINDOW - r->ewma);
+    // then the empty windows, until nothing is left
+    uint64_t k;
+    for (k=w-r->window-1; k>0 && r->ewma >= 1; --k) {
+        r->ewma *= 1 - RATE_ALPHA;
+    }
+    if (k > 0)
+        r->ewma = 0;
+    r->window = w;
+    r->bytes = 0;
+}
+
+// whether a window was folded in
+static inline int
+_rate_add(struct rate* r, uint64_t now, int n) {
+    uint64_t window = r->window;
+    _rate_fold(r, now);
+    r->bytes += n;
+    return r->window != window;
+}
+
+static inline void
+_rate_init(struct rate* r, uint64_t now) {
+    r->window = now / RATE_WINDOW;
+    r->bytes = 0;
+    r->ewma = 0;
+}
+
+static inline double
+_weight(struct client* c) {
+    return c->rrate.ewma + c->wrate.ewma;
+}
+
+static inline void
+_top_set(struct server* s, int i, struct client* c) {
+    s->top[i] = c;
+    c->heap = i;
+}
+
+static void
+_top_down(struct server* s, int i) {
+    struct client* c = s->top[i];
+    for (;;) {
+        int m = i * 2 + 1;
+        if (m >= s->ntop)
+            break;
+        if (m + 1 < s->ntop && _weight(s->top[m+1]) < _weight(s->top[m]))
+            m++;
+        if (_weight(s->top[m]) >= _weight(c))
+            break;
+        _top_set(s, i, s->top[m]);
+        i = m;
+    }
+    _top_set(s, i, c);
+}
+
+static void
+_top_up(struct server* s, int i) {
+    struct client* c = s->top[i];
+    while (i > 0) {
+        int p = (i - 1) / 2;
+        if (_weight(s->top[p]) <= _weight(c))
+            break;
+        _top_set(s, i, s->top[p]);
+        i = p;
+    }
+    _top_set(s, i, c);
+}
+
+// c's rate moved: kept in place, or in for the lightest if heavier
+static void
+_top_update(struct server* s, struct client* c) {
+    if (c->heap >= 0) {
+        _top_up(s, c->heap);
+        _top_down(s, c->heap);
+    } else if (s->ntop < TOP_K) {
+        _top_set(s, s->ntop++, c);
+        _top_up(s, c->heap);
+    } else if (_weight(c) > _weight(s->top[0])) {
+        s->top[0]->heap = -1;
+        _top_set(s, 0, c);
+        _top_down(s, 0);
+    }
+}
+
+static void
+_top_remove(struct server* s, struct client* c) {
+    int i = c->heap;
+    if (i < 0)
+        return;
+    c->heap = -1;
+    struct client* last = s->top[--s->ntop];
+    if (last == c)
+        return;
+    _top_set(s, i, last);
+    _top_up(s, i);
+    _top_down(s, last->heap);
 }
 
-static struct server* s = NULL;
+static inline void
+_account(struct server* s, struct client* c, int rsize, int wsize) {
+    uint64_t now = netev_now(s->ne);
+    s->rtotal += rsize;
+    s->wtotal += wsize;
+    _rate_add(&s->rrate, now, rsize);
+    _rate_add(&s->wrate, now, wsize);
+    if (c == NULL)
+        return;
+    c->rtotal += rsize;
+    c->wtotal += wsize;
+    int folded = _rate_add(&c->rrate, now, rsize);
+    folded |= _rate_add(&c->wrate, now, wsize);
+    if (folded)
+        _top_update(s, c);
+}
 
 static struct client*
 _alloc_clients(int max) {
@@ -62,9 +214,8 @@ _alloc_clients(int max) {
     struct client* c = malloc(max * sizeof(struct client));
     for (i=0; i<max; ++i) {
         c[i].conn_id = i+1;
-        c[i].wbuf_b = NULL;
-        c[i].rstat = 0;
-        c[i].wstat = 0;
+        c[i].active = 0;
+        c[i].heap = -1;
     }
     c[max-1].conn_id = -1;
     return c;
@@ -82,9 +233,15 @@ _create_client(struct server* s, int conn_id) {
     } else
         s->free_client = &s->clients[next];
 
+    uint64_t now = netev_now(s->ne);
     c->conn_id = conn_id;
-    c->wbuf_b = netbuf_alloc_block(s->wbuf, c - s->clients);
-    c->create_time = get_time();
+    c->active = 1;
+    c->rtotal = 0;
+    c->wtotal = 0;
+    _rate_init(&c->rrate, now);
+    _rate_init(&c->wrate, now);
+    c->create_time = now;
+    s->nclient++;
     return c;
 }
 
@@ -96,183 +253,58 @@ _free_client(struct server* s, struct client* c) {
     } else {
         c->conn_id = free - s->clients;
     }
-    netbuf_free_block(s->wbuf, c->wbuf_b);
-    c->wbuf_b = NULL;
-    c->rstat = 0;
-    c->wstat = 0;
+    c->active = 0;
+    _top_remove(s, c);
+    s->nclient--;
     s->free_client = c;
 }
 
 static inline int
 _handle_msg(struct client* c, void* msg, int size) {
-    struct netbuf_block* wbuf_b = c->wbuf_b;
-    int space;
-    if (wbuf_b->roffset > wbuf_b->woffset)
-        space = wbuf_b->roffset - wbuf_b->woffset;
-    else
-        space = wbuf_b->size + wbuf_b->roffset - wbuf_b->woffset;
-    space -= 1;
-    if (space < size) {
-        printf("client %d no wbuf space:%d < size:%d\n", c->conn_id, space, size);
+    if (netev_send_frame(s->ne, c->conn_id, msg, size) != 0) {
+        printf("client %d send error %d, pending %d\n", c->conn_id, 
+                netev_error(s->ne), netev_sendsize(s->ne, c->conn_id));
         return -1; // full
     }
-    void* begin = (void*)wbuf_b + sizeof(*wbuf_b);
-    void* buf = begin + wbuf_b->woffset;
-
-    int size1 = wbuf_b->size - wbuf_b->woffset;
-    int size2 = 0;
-    if (size1 >= size) {
-        size1 = size;
-    } else {
-        size2 = size - size1;
-    }
-    memcpy(buf, msg, size1);
-    if (size2) {
-        memcpy(begin, msg+size1, size2);
-        wbuf_b->woffset = size2;
-    } else {
-        wbuf_b->woffset += size1;
-        if (wbuf_b->woffset == wbuf_b->size)
-            wbuf_b->woffset = 0;
-    }
-    c->rstat+=size;
-    //printf("to client %d, write msg size=%d, woffset=%d roffset=%d\n", 
-            //c->conn_id, size, wbuf_b->woffset, wbuf_b->roffset);
+    size += sizeof(struct msg_header);
+    _account(s, c, size, size);
+    s->this_write_times++;
+    s->this_write += size;
     return 0;
 }
 
-void
-writecb(int fd, int id, void* data) {
-    struct client* c = data;
+// one whole frame, echoed back
+static void
+msgcb(int id, void* msg, int size) {
+    struct client* c = netev_data(s->ne, id);
     if (c == NULL) {
-        printf("client id=%d fd=%d, NULL client write\n", id, fd);
+        printf("id %d, NULL client read\n", id);
         return;
     }
-
-    struct netbuf_block* wbuf_b = c->wbuf_b;
-    if (wbuf_b->roffset == wbuf_b->woffset) {
-        return; // empty
-    }
-    int error;
-    if (wbuf_b->roffset < wbuf_b->woffset) {
-        void* buf = (void*)wbuf_b + sizeof(*wbuf_b) + wbuf_b->roffset;
-        int nbyte = netev_write(s->ne, id, buf, wbuf_b->woffset - wbuf_b->roffset);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte > 0) {
-            wbuf_b->roffset += nbyte;
-            c->wstat += nbyte;
-            
-            s->this_write_times++;
-            s->this_write += nbyte;
-            goto out;
-        }
-    } else {
-        void* begin = (void*)wbuf_b + sizeof(*wbuf_b);
-        void* buf = begin + wbuf_b->roffset;
-        int wsize = wbuf_b->size - wbuf_b->roffset;
-        int nbyte = netev_write(s->ne, id, buf, wsize);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte == 0) {
-            goto out;
-        }
-        c->wstat += nbyte;
-        s->this_write_times++;
-        s->this_write += nbyte;
-
-        if (nbyte < wsize) {
-            wbuf_b->roffset += nbyte;
-            goto out;
-        }
-        wbuf_b->roffset = 0;
-        wsize = wbuf_b->woffset;
-        if (wsize == 0) { 
-            goto out;
-        }
-        nbyte = netev_write(s->ne, id, begin, wsize);
-        if (nbyte == -1) {
-            goto err_out;
-        }
-        if (nbyte > 0) {
-            wbuf_b->roffset += nbyte;
-            c->wstat += nbyte;
-
-            s->this_write_times++;
-            s->this_write += nbyte;
-
-            goto out;
-        } 
-    }
-out:
-    //printf("write size=%d, woffset=%d roffset=%d\n", 
-            //c->wstat - oldstat, wbuf_b->woffset, wbuf_b->roffset);
-    return;
-err_out:
-    error = netev_error(s->ne);
-    printf("client id=%d fd=%d, write occur error %d\n", id, fd, error);
-    _free_client(s, c);
-    s->nwclosed += 1;
-}
-
-void
-readcb(int fd, int id, void* data) {
-    struct client* c = data;
-    if (c == NULL) {
-        printf("id %d, NULL client read\n", id);
+    s->this_read += sizeof(struct msg_header) + size;
+    if (size == 0 || _handle_msg(c, msg, size) != 0) {
+        // an empty frame is the peer's error, not the server's
+        printf("client id=%d %s\n", id, size == 0 ? "sent an empty frame" : "handle_msg occur error");
+        netev_close_socket(s->ne, id);
+        _free_client(s, c);
+        s->nhclosed += 1;
         return;
     }
+    s->this_read_times++;
+}
 
-    int error = NETEV_OK;
-    for (;;) {
-        struct msg_header* h = netev_read(s->ne, id, sizeof(struct msg_header));
-        if (h == NULL) {
-            error = netev_error(s->ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-
-        s->this_read += sizeof(struct msg_header);
-        assert(h->size > 0);
-        
-        void* msg = netev_read(s->ne, id, h->size);
-        if (msg == NULL) {
-            error = netev_error(s->ne);
-            if (error == NETEV_OK) {
-                goto out;
-            } else {
-                goto err_out;
-            }
-        }
-        //printf("from client id=%d fd=%d, read msg size=%d\n", id, fd, h->size);
-
-        s->this_read += h->size;
-        if (_handle_msg(c, (void*)h, sizeof(*h) + h->size) != 0) {
-            goto err_out2;
-        }
-
-        netev_dropread(s->ne, id);
-        s->this_read_times++;
+// udp mode: every datagram is echoed to its sender
+static void
+dgramcb(int id, const void* msg, int size, uint32_t addr, uint16_t port, void* data) {
+    s->this_read_times++;
+    s->this_read += size;
+    if (netev_sendto(s->ne, id, msg, size, addr, port) != 0) {
+        _account(s, NULL, size, 0);
+        return; // queue full, dropped as the network would
     }
-out:
-    return;
-err_out:
-    printf("client id=%d fd=%d read occur error %d\n", id, fd, error);
-    _free_client(s, c);
-    s->nrclosed += 1;
-    return;
-err_out2:
-    printf("client id=%d fd=%d handle_msg occur error\n", id, fd);
-    netev_close_socket(s->ne, id);
-    _free_client(s, c);
-    s->nhclosed += 1;
-    return;
-
+    _account(s, NULL, size, size);
+    s->this_write_times++;
+    s->this_write += size;
 }
 
 void 
@@ -287,47 +319,183 @@ listencb(int fd, int id) {
     s->naccept += 1;
     struct client* c = _create_client(s, id);
     assert(c);
-    netev_add_event(s->ne, id, NETEV_READ|NETEV_WRITE, readcb, writecb, c);
+    netev_add_frame(s->ne, id, NETEV_FRAME_U16LE, msgcb, NULL, c);
 }
 
-static inline int 
-_is_client_closed(struct client* c) {
-    return c->wbuf_b == NULL;
+static int
+_cmp_weight(const void* a, const void* b) {
+    double x = _weight(*(struct client**)a);
+    double y = _weight(*(struct client**)b);
+    return x < y ? 1 : x > y ? -1 : 0;
 }
 
+// the thread's rates and its heaviest connections. the heap's rates 
+// are brought to now first, one that went quiet only decays on a fold
 static void 
 _statistics() { 
-    uint64_t now = get_time();
-    double total_rrate = 0;
-    double total_wrate = 0;
-    double top_rrate = 0;
-    double top_wrate = 0;
-    int nclient = 0;
+    uint64_t now = netev_now(s->ne);
+    _rate_fold(&s->rrate, now);
+    _rate_fold(&s->wrate, now);
     int i;
-    for (i=0; i<s->max; ++i) {
-        struct client* c = &s->clients[i];
-        if (_is_client_closed(c)) 
-            continue;
-        uint64_t elapse = now - c->create_time;
-        double rrate = 0;
-        double wrate = 0;
-        if (elapse > 0) {
-            rrate = c->rstat / (double)elapse * 1000.0;
-            wrate = c->wstat / (double)elapse * 1000.0;
-        }
-        total_rrate += rrate;
-        total_wrate += wrate;
-        nclient += 1;
-        if (rrate > top_rrate)
-            top_rrate = rrate;
-        if (wrate > top_wrate)
-            top_wrate = wrate;
+    for (i=0; i<s->ntop; ++i) {
+        _rate_fold(&s->top[i]->rrate, now);
+        _rate_fold(&s->top[i]->wrate, now);
     }
-    if (nclient == 0)
-        nclient = 1;
-    printf("statistic : rrate %f wrate %f top_rrate %f top_wrate %f\n",
-            total_rrate / nclient, total_wrate / nclient,
-            top_rrate, top_wrate);
+    for (i=s->ntop/2-1; i>=0; --i) {
+        _top_down(s, i);
+    }
+    double share = s->nclient > 0 ? 1.0 / s->nclient : 0;
+    printf("statistic : clients %d, rrate %.0f wrate %.0f, per client %.0f %.0f, "
+            "total read %llu write %llu\n",
+            s->nclient, s->rrate.ewma, s->wrate.ewma,
+            s->rrate.ewma * share, s->wrate.ewma * share,
+            (unsigned long long)s->rtotal, (unsigned long long)s->wtotal);
+    if (s->ntop == 0)
+        return;
+    struct client* top[TOP_K];
+    memcpy(top, s->top, s->ntop * sizeof(top[0]));
+    qsort(top, s->ntop, sizeof(top[0]), _cmp_weight);
+    char line[TOP_K * 48];
+    int n = 0;
+    for (i=0; i<s->ntop; ++i) {
+        n += snprintf(line + n, sizeof(line) - n, " %d:%.0f/%.0f", 
+                top[i]->conn_id, top[i]->rrate.ewma, top[i]->wrate.ewma);
+    }
+    printf("statistic : top id:rrate/wrate%s\n", line);
+}
+
+// closed by netev: peer gone, bad frame, idle, or stuck in the middle of a message
+static void
+closecb(int fd, int id, void* data, int error) {
+    struct client* c = data;
+    if (c == NULL)
+        return;
+    printf("client id=%d fd=%d closed, error %d\n", id, fd, error);
+    _free_client(s, c);
+    if (error == NETEV_ERR_TIMEOUT || error == NETEV_ERR_MSGTIMEOUT)
+        s->ntclosed += 1;
+    else
+        s->nrclosed += 1;
+}
+
+static struct server*
+_create_server(struct netev* ne, int max, int buf_size, int spin) {
+    struct server* s = malloc(sizeof(struct server));
+    memset(s, 0, sizeof(*s));
+    s->ne = ne;
+    if (spin > 0)
+        netev_set_busy_poll(ne, spin, spin);
+    netev_set_send_limit(ne, buf_size*1024);
+    // a client that stops reading stops being read, well before the limit
+    netev_set_watermark(ne, buf_size*1024/2, buf_size*1024/8, NULL);
+    netev_set_timeout(ne, IDLE_TIMEOUT, MSG_TIMEOUT);
+    netev_set_read_budget(ne, READ_BUDGET, 0); // a firehose client can't hold up the rest
+    netev_set_closecb(ne, closecb);
+    netev_set_timing(ne, 1);
+    s->clients = _alloc_clients(max);
+    s->free_client = &s->clients[0];
+    s->max = max;
+    s->last_report = netev_now(ne);
+    _rate_init(&s->rrate, s->last_report);
+    _rate_init(&s->wrate, s->last_report);
+    return s;
+}
+
+// per loop, once a second
+static void
+_report(int id, void* data) {
+    uint64_t now = netev_now(s->ne);
+    uint64_t elapse = now - s->last_report;
+    if (elapse == 0)
+        elapse = 1;
+    printf("thread %d, accept %d, wclosed %d, rclosed %d, hclosed %d, tclosed %d, "
+            "rtimes/s %.0f, wtimes/s %.0f, rbytes/s %.0f, wbytes/s %.0f\n",
+            s->index, s->naccept, s->nwclosed, s->nrclosed, s->nhclosed, s->ntclosed,
+            s->this_read_times * 1000.0 / elapse, 
+            s->this_write_times * 1000.0 / elapse,
+            s->this_read * 1000.0 / elapse, 
+            s->this_write * 1000.0 / elapse);
+    s->this_read_times = 0;
+    s->this_write_times = 0;
+    s->this_read = 0;
+    s->this_write = 0;
+    s->last_report = now;
+    _statistics();
+
+    struct netev_stats st;
+    struct netev_stats* l = &s->last;
+    netev_stats(s->ne, &st);
+    uint64_t loop[NETEV_HIST], callback[NETEV_HIST];
+    int i;
+    for (i=0; i<NETEV_HIST; ++i) {
+        loop[i] = st.hist_loop[i] - l->hist_loop[i];
+        callback[i] = st.hist_callback[i] - l->hist_callback[i];
+    }
+    uint64_t nwakeup = st.nwakeup - l->nwakeup;
+    uint64_t nread = st.nread - l->nread;
+    uint64_t nwrite = st.nwrite - l->nwrite;
+    printf("thread %d, sockets %lld, dispatching %.1f%%, blocked %.1f%% of the time, "
+            "events/wakeup %.1f, loop p50 %llu p99 %llu us, callback p99 %llu ns, "
+            "reads/s %.0f (EAGAIN %.1f%%), writes/s %.0f (EAGAIN %.1f%%)\n",
+            s->index, (long long)st.nsocket,
+            (st.dispatch_ns - l->dispatch_ns) / (elapse * 10000.0),
+            (st.block_ns - l->block_ns) / (elapse * 10000.0),
+            nwakeup ? (double)(st.nevent - l->nevent) / nwakeup : 0.0,
+            (unsigned long long)netev_hist_quantile(loop, 0.5) / 1000,
+            (unsigned long long)netev_hist_quantile(loop, 0.99) / 1000,
+            (unsigned long long)netev_hist_quantile(callback, 0.99),
+            nread * 1000.0 / elapse,
+            nread ? (st.nread_again - l->nread_again) * 100.0 / nread : 0.0,
+            nwrite * 1000.0 / elapse,
+            nwrite ? (st.nwrite_again - l->nwrite_again) * 100.0 / nwrite : 0.0);
+    if (st.spin_ns > 0) {
+        printf("thread %d, spinning %.1f%% of the time, spins that found work %llu\n",
+                s->index, (st.spin_ns - l->spin_ns) / (elapse * 10000.0),
+                (unsigned long long)st.nspin);
+    }
+    if (st.ncork_flush > l->ncork_flush) {
+        printf("thread %d, echoes per writev %.1f\n", s->index,
+                (double)(st.ncorked - l->ncorked) / (st.ncork_flush - l->ncork_flush));
+    }
+    if (st.npaused > l->npaused) {
+        printf("thread %d, input paused at the output watermark %llu times\n", s->index,
+                (unsigned long long)(st.npaused - l->npaused));
+    }
+    *l = st;
+    if (st.nrecvmmsg > 0) {
+        printf("thread %d, datagrams per recvmmsg %.1f, per sendmmsg %.1f, dropped %llu\n",
+                s->index, (double)st.ndgram_in / st.nrecvmmsg,
+                st.nsendmmsg ? (double)st.ndgram_out / st.nsendmmsg : 0.0,
+                (unsigned long long)st.ndgram_drop);
+    }
+}
+
+static void
+_thread_init(struct netev* ne, int index, void* ud) {
+    struct config* conf = ud;
+    s = _create_server(ne, conf->max, conf->buf_size, conf->spin);
+    s->index = index;
+    netev_add_timer(ne, 1000, 1000, _report, NULL);
+    if (conf->udp && netev_udp(ne, conf->addr, conf->port, conf->udp - 1, dgramcb, NULL) < 0) {
+        printf("thread %d udp bind failed\n", index);
+    }
+}
+
+static int
+_start_group(uint32_t addr, uint16_t port, struct config* conf, int nthread) {
+    struct netgroup* g = netgroup_create(nthread, conf->max+1, 64*1024, NETEV_CORK);
+    if (g == NULL)
+        return -1;
+    if (!conf->udp && 
+        netgroup_listen(g, addr, port, 0, listencb, NULL) != 0) 
+        return -1;
+    int cpus[nthread];
+    int ncpu = sysconf(_SC_NPROCESSORS_ONLN);
+    int i;
+    for (i=0; i<nthread; ++i) {
+        cpus[i] = ncpu > 0 ? i % ncpu : -1;
+    }
+    return netgroup_start(g, cpus, _thread_init, NULL, conf);
 }
 
 static void 
@@ -339,7 +507,7 @@ _sigint_handler() {
 int 
 main(int argc, char* argv[]) {
     if (argc < 2) {
-        printf("usage: %s ip:port\n", argv[0]);
+        printf("usage: %s ip:port [max] [buf_size] [thread] [tcp|udp|udp-gso] [spin_us]\n", argv[0]);
         return -1;
     }
 
@@ -366,48 +534,59 @@ main(int argc, char* argv[]) {
     if (argc > 3)
         buf_size = strtol(argv[3], NULL, 10);
 
-    struct netev* ne = netev_create(max, 64*1024);
-    struct netbuf* wbuf = netbuf_create(max, buf_size*1024);
+    int nthread = 1;
+    if (argc > 4)
+        nthread = strtol(argv[4], NULL, 10);
+
+    // udp: an echo per datagram, rtimes/s per thread is packets per second per core
+    int udp = 0;
+    if (argc > 5 && strcmp(argv[5], "udp") == 0)
+        udp = 1;
+    else if (argc > 5 && strcmp(argv[5], "udp-gso") == 0)
+        udp = 1 + (NETEV_UDP_GSO|NETEV_UDP_GRO);
+
+    // burn the loop's core polling for this long before each wait
+    int spin = 0;
+    if (argc > 6)
+        spin = strtol(argv[6], NULL, 10);
+
+    signal(SIGINT, _sigint_handler);
+
+    if (nthread > 1) {
+        static struct config conf;
+        conf.max = max;
+        conf.buf_size = buf_size;
+        conf.udp = udp;
+        conf.spin = spin;
+        conf.addr = addr;
+        conf.port = port;
+        if (_start_group(addr, port, &conf, nthread) != 0) {
+            return -1;
+        }
+        printf("server start %s on %s, max=%d per thread, thread=%d\n", 
+                udp ? "udp" : "listen", argv[1], max, nthread);
+        for (;;) {
+            pause();
+        }
+    }
 
-    int r = netev_listen(ne, addr, port, listencb);
+    // echoes of one read go out in one writev
+    struct netev* ne = netev_create_flags(max+1, 64*1024, NETEV_CORK); // and the listen socket
+    s = _create_server(ne, max, buf_size, spin);
+    int r = udp ? 
+        (netev_udp(ne, addr, port, udp - 1, dgramcb, NULL) >= 0 ? 0 : -1) :
+        netev_listen(ne, addr, port, listencb);
     if (r != 0) {
         return -1; 
     }
-    printf("server start listen on %s, max=%d\n", argv[1], max);
-
-    s = malloc(sizeof(struct server));
-    s->ne = ne;
-    s->wbuf = wbuf;
-    s->clients = _alloc_clients(max);
-    s->free_client = &s->clients[0];
-    s->max = max;
-    s->naccept = 0;
-    s->nwclosed = 0;
-    s->nrclosed = 0;
-    s->nhclosed = 0;
+    printf("server start %s on %s, max=%d\n", udp ? "udp" : "listen", argv[1], max);
 
-    signal(SIGINT, _sigint_handler);
+    netev_add_timer(ne, 1000, 1000, _report, NULL);
 
-    uint32_t i = 1;
-    uint64_t last_time = get_time();
     for (;;) {
-        s->this_read_times = 0;
-        s->this_write_times = 0;
-        s->this_read = 0;
-        s->this_write = 0;
-
-        int nfd = netev_poll(s->ne, 1);  
-        //_statistics();
-        uint64_t now = get_time();
-        uint32_t elapse = now - last_time;
-        last_time = now;
-        uint32_t t = elapse > 10 ? 1 : 10 - elapse; 
-        printf("%06u, nfd %d, elapse %u t %u, max %d, accept %d, wclosed %d, rclosed %d, hclosed %d, rtimes %u, wtimes %u, rbytes %u, wbytes %u -- \n", 
-                i++, nfd, elapse, t, s->max, s->naccept, s->nwclosed, s->nrclosed, s->nhclosed, s->this_read_times, s->this_write_times, s->this_read, s->this_write); 
-        usleep(t*1000);
+        netev_poll(s->ne, -1); // woken by I/O or the report timer
     }
     netev_free(s->ne);
-    netbuf_free(s->wbuf);
     free(s->clients);
     free(s);
     return 0;
@@ -0,0 +1,95 @@
+#include "netev.h"
+#include <arpa/inet.h>
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <netinet/in.h>
+
+// the message timeout only runs while a message is incomplete: a handler
+// reading until NULL must leave an idle connection alone, one waiting 
+// for the rest of a message is closed with NETEV_ERR_MSGTIMEOUT
+
+#define IDLE_TIMEOUT 60000
+#define MSG_TIMEOUT  300
+
+static struct netev* ne = NULL;
+static int msgsize = 1;
+static int closed_error = -1;
+
+static void
+readcb(int fd, int id, void* data) {
+    while (netev_read(ne, id, msgsize)) {
+        netev_dropread(ne, id);
+    }
+    if (netev_error(ne) != NETEV_OK)
+        closed_error = netev_error(ne);
+}
+
+static void
+listencb(int fd, int id) {
+    netev_add_event(ne, id, NETEV_READ, readcb, NULL, NULL);
+}
+
+static void
+closecb(int fd, int id, void* data, int error) {
+    closed_error = error;
+}
+
+// sends one byte, then stays connected and silent
+static void
+_client(uint16_t port, int ms) {
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = inet_addr("127.0.0.1");
+    if (connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0)
+        _exit(1);
+    if (write(fd, "x", 1) != 1)
+        _exit(1);
+    usleep(ms * 1000);
+    _exit(0);
+}
+
+// the error the connection was closed with after wait ms, -1 if open
+static int
+_run(uint16_t port, int size, int wait) {
+    ne = netev_create(10, 64*1024);
+    netev_set_timeout(ne, IDLE_TIMEOUT, MSG_TIMEOUT);
+    netev_set_closecb(ne, closecb);
+    if (netev_listen(ne, inet_addr("127.0.0.1"), port, listencb) != 0) {
+        printf("listen on %u failed\n", port);
+        exit(1);
+    }
+    msgsize = size;
+    closed_error = -1;
+    pid_t pid = fork();
+    if (pid == 0) {
+        _client(port, wait + 500);
+    }
+    uint64_t start = netev_now(ne);
+    while (netev_now(ne) - start < (uint64_t)wait) {
+        netev_poll(ne, 10);
+    }
+    waitpid(pid, NULL, 0);
+    netev_free(ne);
+    return closed_error;
+}
+
+int 
+main(int argc, char* argv[]) {
+    uint16_t port = argc > 1 ? strtol(argv[1], NULL, 10) : 23500;
+    int fail = 0;
+    int error = _run(port, 1, MSG_TIMEOUT * 3);
+    printf("whole message, then idle: %s\n", error == -1 ? "open, ok" : "closed, FAIL");
+    fail |= error != -1;
+    error = _run(port+1, 2, MSG_TIMEOUT * 3);
+    printf("half a message: %s\n", error == NETEV_ERR_MSGTIMEOUT ? 
+            "closed with NETEV_ERR_MSGTIMEOUT, ok" : "FAIL");
+    fail |= error != NETEV_ERR_MSGTIMEOUT;
+    return fail;
+}
@@ -0,0 +1,315 @@
+#include "timewheel.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define NEAR_SHIFT  8
+#define NEAR        (1 << NEAR_SHIFT)
+#define NEAR_MASK   (NEAR - 1)
+#define LEVEL_SHIFT 6
+#define LEVEL       (1 << LEVEL_SHIFT)
+#define LEVEL_MASK  (LEVEL - 1)
+#define NLEVEL      4
+
+#define SLOT_NONE   -1
+
+struct tlink {
+    struct tlink* prev;
+    struct tlink* next;
+};
+
+struct timer {
+    struct tlink link; // first, a link is its timer
+    uint32_t expire;
+    int interval;
+    int slot; // near 0..NEAR-1, then the levels, SLOT_NONE if not scheduled
+    int id;
+    timewheel_cb cb;
+    void* data;
+};
+
+struct timewheel {
+    uint64_t start;
+    uint32_t time; // ms since start
+    int count;
+
+    struct tlink near[NEAR];
+    struct tlink level[NLEVEL][LEVEL];
+    uint64_t near_bits[NEAR / 64];
+
+    struct timer** timers; // by id
+    int cap;
+    struct timer* free_timer;
+};
+
+static inline void
+_tlink_init(struct tlink* l) {
+    l->prev = l;
+    l->next = l;
+}
+
+static inline int
+_tlink_empty(struct tlink* l) {
+    return l->next == l;
+}
+
+static inline void
+_tlink_remove(struct tlink* l) {
+    l->prev->next = l->next;
+    l->next->prev = l->prev;
+    l->prev = l;
+    l->next = l;
+}
+
+static inline void
+_tlink_push(struct tlink* head, struct tlink* l) {
+    l->prev = head->prev;
+    l->next = head;
+    head->prev->next = l;
+    head->prev = l;
+}
+
+// move all of src to the empty list dst
+static inline void
+_tlink_move(struct tlink* dst, struct tlink* src) {
+    if (_tlink_empty(src)) {
+        _tlink_init(dst);
+        return;
+    }
+    dst->next = src->next;
+    dst->prev = src->prev;
+    dst->next->prev = dst;
+    dst->prev->next = dst;
+    _tlink_init(src);
+}
+
+static inline struct tlink*
+_slot_head(struct timewheel* self, int slot) {
+    if (slot < NEAR)
+        return &self->near[slot];
+    slot -= NEAR;
+    return &self->level[slot / LEVEL][slot % LEVEL];
+}
+
+static void
+_schedule(struct timewheel* self, struct timer* t) {
+    uint32_t expire = t->expire;
+    uint32_t current = self->time;
+    if ((expire | NEAR_MASK) == (current | NEAR_MASK)) {
+        t->slot = expire & NEAR_MASK;
+        self->near_bits[t->slot / 64] |= 1ULL << (t->slot % 64);
+    } else {
+        int i;
+        uint32_t mask = NEAR << LEVEL_SHIFT;
+        for (i=0; i<NLEVEL-1; ++i) {
+            if ((expire | (mask - 1)) == (current | (mask - 1)))
+                break;
+            mask <<= LEVEL_SHIFT;
+        }
+        int idx = (expire >> (NEAR_SHIFT + i * LEVEL_SHIFT)) & LEVEL_MASK;
+        t->slot = NEAR + i * LEVEL + idx;
+    }
+    _tlink_push(_slot_head(self, t->slot), &t->link);
+}
+
+static inline void
+_unschedule(struct timewheel* self, struct timer* t) {
+    struct tlink* head = _slot_head(self, t->slot);
+    _tlink_remove(&t->link);
+    if (t->slot < NEAR && _tlink_empty(head)) {
+        self->near_bits[t->slot / 64] &= ~(1ULL << (t->slot % 64));
+    }
+    t->slot = SLOT_NONE;
+}
+
+// re-add a level slot's timers, they land nearer now
+static void
+_cascade(struct timewheel* self, int level, int idx) {
+    struct tlink list;
+    _tlink_move(&list, &self->level[level][idx]);
+    while (!_tlink_empty(&list)) {
+        struct timer* t = (struct timer*)list.next;
+        _tlink_remove(&t->link);
+        _schedule(self, t);
+    }
+}
+
+static void
+_shift(struct timewheel* self) {
+    uint32_t ct = ++self->time;
+    if (ct == 0) {
+        _cascade(self, NLEVEL-1, 0);
+        return;
+    }
+    uint32_t mask = NEAR;
+    uint32_t time = ct >> NEAR_SHIFT;
+    int i = 0;
+    while ((ct & (mask - 1)) == 0) {
+        int idx = time & LEVEL_MASK;
+        if (idx != 0) {
+            _cascade(self, i, idx);
+            break;
+        }
+        mask <<= LEVEL_SHIFT;
+        time >>= LEVEL_SHIFT;
+        ++i;
+    }
+}
+
+static inline void
+_release(struct timewheel* self, struct timer* t) {
+    t->cb = NULL;
+    t->data = NULL;
+    t->link.next = (struct tlink*)self->free_timer;
+    self->free_timer = t;
+}
+
+static int
+_execute(struct timewheel* self) {
+    int slot = self->time & NEAR_MASK;
+    if (_tlink_empty(&self->near[slot]))
+        return 0;
+    struct tlink list;
+    _tlink_move(&list, &self->near[slot]);
+    self->near_bits[slot / 64] &= ~(1ULL << (slot % 64));
+    int n = 0;
+    while (!_tlink_empty(&list)) {
+        struct timer* t = (struct timer*)list.next;
+        _tlink_remove(&t->link);
+        t->slot = SLOT_NONE;
+        timewheel_cb cb = t->cb;
+        void* data = t->data;
+        if (t->interval > 0) {
+            // rescheduled first, so the callback may delete it
+            t->expire = self->time + t->interval;
+            _schedule(self, t);
+        } else {
+            self->count--;
+            _release(self, t);
+        }
+        cb(t->id, data);
+        n++;
+    }
+    return n;
+}
+
+struct timewheel*
+timewheel_create(uint64_t now) {
+    struct timewheel* tw = malloc(sizeof(struct timewheel));
+    memset(tw, 0, sizeof(*tw));
+    tw->start = now;
+    int i, j;
+    for (i=0; i<NEAR; ++i) {
+        _tlink_init(&tw->near[i]);
+    }
+    for (i=0; i<NLEVEL; ++i) {
+        for (j=0; j<LEVEL; ++j) {
+            _tlink_init(&tw->level[i][j]);
+        }
+    }
+    return tw;
+}
+
+void
+timewheel_free(struct timewheel* self) {
+    if (self == NULL)
+        return;
+    int i;
+    for (i=0; i<self->cap; ++i) {
+        free(self->timers[i]);
+    }
+    free(self->timers);
+    free(self);
+}
+
+static struct timer*
+_alloc_timer(struct timewheel* self) {
+    if (self->free_timer == NULL) {
+        int cap = self->cap ? self->cap * 2 : 64;
+        self->timers = realloc(self->timers, cap * sizeof(struct timer*));
+        int i;
+        for (i=cap-1; i>=self->cap; --i) {
+            struct timer* t = malloc(sizeof(struct timer));
+            t->id = i;
+            t->slot = SLOT_NONE;
+            self->timers[i] = t;
+            _release(self, t);
+        }
+        self->cap = cap;
+    }
+    struct timer* t = self->free_timer;
+    self->free_timer = (struct timer*)t->link.next;
+    _tlink_init(&t->link);
+    return t;
+}
+
+int
+timewheel_add(struct timewheel* self, uint64_t now, int delay, int interval, 
+        timewheel_cb cb, void* data) {
+    if (cb == NULL)
+        return -1;
+    // the wheel may lag now by a round of callbacks, count from now
+    uint32_t current = now - self->start;
+    if ((int32_t)(current - self->time) < 0)
+        current = self->time;
+    struct timer* t = _alloc_timer(self);
+    t->expire = current + (delay > 0 ? delay : 0);
+    t->interval = interval > 0 ? interval : 0;
+    t->cb = cb;
+    t->data = data;
+    _schedule(self, t);
+    self->count++;
+    return t->id;
+}
+
+int
+timewheel_del(struct timewheel* self, int id) {
+    if (id < 0 || id >= self->cap)
+        return -1;
+    struct timer* t = self->timers[id];
+    if (t->cb == NULL)
+        return -1;
+    if (t->slot != SLOT_NONE) {
+        _unschedule(self, t);
+    }
+    self->count--;
+    _release(self, t);
+    return 0;
+}
+
+int
+timewheel_timeout(struct timewheel* self) {
+    if (self->count == 0)
+        return -1;
+    int cur = self->time & NEAR_MASK;
+    int i = cur / 64;
+    uint64_t bits = self->near_bits[i] & (~0ULL << (cur % 64));
+    for (;;) {
+        if (bits)
+            return i * 64 + __builtin_ctzll(bits) - cur;
+        if (++i == NEAR / 64)
+            break;
+        bits = self->near_bits[i];
+    }
+    return NEAR - cur;
+}
+
+int
+timewheel_update(struct timewheel* self, uint64_t now) {
+    uint32_t target = now - self->start;
+    if ((int32_t)(target - self->time) < 0)
+        return 0;
+    if (self->count == 0) {
+        self->time = target; // nothing to cascade, jump
+        return 0;
+    }
+    int n = _execute(self);
+    while (self->time != target) {
+        _shift(self);
+        n += _execute(self);
+        if (self->count == 0) {
+            self->time = target;
+            break;
+        }
+    }
+    return n;
+}
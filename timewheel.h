@@ -0,0 +1,30 @@
+#ifndef __TIMEWHEEL_H__
+#define __TIMEWHEEL_H__
+
+#include <stdint.h>
+
+// hierarchical timing wheel with 1 ms ticks: 256 near slots, then 4 levels
+// of 64 slots cascading down. add, del and firing are O(1)
+
+typedef void (*timewheel_cb)(int id, void* data);
+
+struct timewheel;
+
+struct timewheel* timewheel_create(uint64_t now);
+void timewheel_free(struct timewheel* self);
+
+// fires at now + delay, then every interval ms if interval > 0. now is
+// the caller's clock, it may be ahead of the last timewheel_update.
+// a one-shot id is free again once it fired
+int timewheel_add(struct timewheel* self, uint64_t now, int delay, int interval, 
+        timewheel_cb cb, void* data);
+int timewheel_del(struct timewheel* self, int id);
+
+// ms until the next near slot holding a timer, or until the next cascade
+// when only far timers are left. -1 without timers
+int timewheel_timeout(struct timewheel* self);
+
+// fire everything due up to now, returns the number fired
+int timewheel_update(struct timewheel* self, uint64_t now);
+
+#endif